@@ -0,0 +1,175 @@
+#pragma once
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace pthash {
+
+/*
+    Performs write jobs in a background thread, in submission order, so that the caller
+    can keep filling other buffers meanwhile. Each job accounts for the bytes of the
+    buffer it owns: a submission blocks while more than 'max_pending_bytes' bytes are
+    in flight (but a single job is always accepted, whatever its size).
+    An error raised by a job is rethrown by the next call to push, wait or close.
+*/
+struct async_writer {
+    async_writer(const uint64_t max_pending_bytes)
+        : m_max_pending_bytes(max_pending_bytes)
+        , m_pending_bytes(0)
+        , m_stop(false)
+        , m_thread(&async_writer::run, this) {}
+
+    async_writer(async_writer const&) = delete;
+    async_writer& operator=(async_writer const&) = delete;
+
+    ~async_writer() {
+        try {
+            close();
+        } catch (...) {
+        }
+    }
+
+    void push(const uint64_t bytes, std::function<void()> job) {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_cv.wait(lock, [&] {
+            return m_error or m_pending_bytes == 0 or
+                   m_pending_bytes + bytes <= m_max_pending_bytes;
+        });
+        rethrow_error();
+        m_pending_bytes += bytes;
+        m_jobs.push_back({bytes, std::move(job)});
+        m_cv.notify_all();
+    }
+
+    /* Append the buffer to the stream, that must outlive the write. */
+    template <typename T>
+    void write(std::ofstream& out, std::vector<T>&& buffer) {
+        const uint64_t bytes = buffer.size() * sizeof(T);
+        push(bytes, [&out, buffer = std::move(buffer)]() {
+            out.write(reinterpret_cast<char const*>(buffer.data()), buffer.size() * sizeof(T));
+            if (out.fail()) throw std::runtime_error("cannot write temporary file");
+        });
+    }
+
+    /* Wait for all the submitted jobs to complete. */
+    void wait() {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_cv.wait(lock, [&] { return m_pending_bytes == 0 and m_jobs.empty(); });
+        rethrow_error();
+    }
+
+    void close() {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stop = true;
+        }
+        m_cv.notify_all();
+        if (m_thread.joinable()) m_thread.join();
+        std::lock_guard<std::mutex> lock(m_mutex);
+        rethrow_error();
+    }
+
+private:
+    struct job_t {
+        uint64_t bytes;
+        std::function<void()> run;
+    };
+
+    void rethrow_error() {
+        if (m_error) {
+            auto error = m_error;
+            m_error = nullptr;
+            std::rethrow_exception(error);
+        }
+    }
+
+    void run() {
+        while (true) {
+            job_t job;
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_cv.wait(lock, [&] { return m_stop or !m_jobs.empty(); });
+                if (m_jobs.empty()) return;
+                job = std::move(m_jobs.front());
+                m_jobs.pop_front();
+            }
+            std::exception_ptr error;
+            try {
+                job.run();
+            } catch (...) {
+                error = std::current_exception();
+            }
+            job.run = nullptr;  // release the buffer
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                if (error and !m_error) m_error = error;
+                m_pending_bytes -= job.bytes;
+            }
+            m_cv.notify_all();
+        }
+    }
+
+    uint64_t m_max_pending_bytes;
+    uint64_t m_pending_bytes;
+    bool m_stop;
+    std::exception_ptr m_error;
+    std::deque<job_t> m_jobs;
+    std::mutex m_mutex;
+    std::condition_variable m_cv;
+    std::thread m_thread;  // last, so that it starts after the other members are initialized
+};
+
+/*
+    Ask the kernel to asynchronously load the pages of a memory-mapped file
+    spanning the range [begin, end), before they are accessed.
+*/
+static inline void read_ahead(void const* begin, void const* end) {
+    static const uintptr_t page_size = sysconf(_SC_PAGESIZE);
+    const uintptr_t first = reinterpret_cast<uintptr_t>(begin) & ~(page_size - 1);
+    const uintptr_t last = reinterpret_cast<uintptr_t>(end);
+    if (last <= first) return;
+    posix_madvise(reinterpret_cast<void*>(first), last - first, POSIX_MADV_WILLNEED);
+}
+
+/*
+    Write back the dirty pages of the range [offset, offset + bytes) of a file (bytes = 0 means
+    up to the end of the file) and evict them from the page cache, so that temporary files
+    do not push the pages of other processes out of memory. Best effort: errors are ignored.
+*/
+static inline void evict_from_page_cache(std::string const& filename, const uint64_t offset = 0,
+                                         const uint64_t bytes = 0) {
+    int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd == -1) return;
+    ::fdatasync(fd);
+    ::posix_fadvise(fd, offset, bytes, POSIX_FADV_DONTNEED);
+    ::close(fd);
+}
+
+/*
+    Release the pages of the range [begin, end) of a memory-mapped file, that have been
+    consumed, and evict them from the page cache.
+*/
+static inline void evict_consumed(std::string const& filename, void const* data,
+                                  void const* begin, void const* end) {
+    static const uintptr_t page_size = sysconf(_SC_PAGESIZE);
+    const uintptr_t base = reinterpret_cast<uintptr_t>(data);
+    const uintptr_t first = reinterpret_cast<uintptr_t>(begin) & ~(page_size - 1);
+    const uintptr_t last = reinterpret_cast<uintptr_t>(end) & ~(page_size - 1);
+    if (last <= first) return;
+    ::madvise(reinterpret_cast<void*>(first), last - first, MADV_DONTNEED);
+    evict_from_page_cache(filename, first - base, last - first);
+}
+
+}  // namespace pthash
\ No newline at end of file
@@ -0,0 +1,445 @@
+#pragma once
+
+#include "builders/util.hpp"
+#include "builders/async_io.hpp"
+#include "mm_file/mm_file.hpp"
+#include "builders/internal_memory_builder_single_phf.hpp"
+#include "builders/internal_memory_builder_partitioned_phf.hpp"
+
+namespace pthash {
+
+/*
+    External-memory construction of dense_partitioned_phf.
+    Hash codes are spilled to disk by ranges of consecutive partitions, each range being
+    sized to fit in config.ram. The partitions of a range are built in memory, then their
+    pilots are written to disk in interleaved order, i.e., bucket-major, which is the order
+    in which the dense encoders consume them. Only the global bitmap of taken slots
+    and the seeds of the partitions are kept in memory for the whole construction.
+*/
+template <typename Hasher, typename Bucketer>
+struct external_memory_builder_dense_partitioned_phf {
+    typedef Hasher hasher_type;
+    typedef Bucketer bucketer_type;
+    typedef typename hasher_type::hash_type hash_type;
+
+    external_memory_builder_dense_partitioned_phf()
+        : m_pilots_filename(""), m_free_slots_filename("") {}
+    // non construction-copyable
+    external_memory_builder_dense_partitioned_phf(
+        external_memory_builder_dense_partitioned_phf const&) = delete;
+    // non copyable
+    external_memory_builder_dense_partitioned_phf& operator=(
+        external_memory_builder_dense_partitioned_phf const&) = delete;
+
+    ~external_memory_builder_dense_partitioned_phf() {
+        remove_files();
+    }
+
+    template <typename Iterator>
+    build_timings build_from_keys(Iterator keys, const uint64_t num_keys,
+                                  build_configuration const& config)  //
+    {
+        assert(num_keys > 0);
+        util::check_hash_collision_probability<Hasher>(num_keys);
+
+        const uint64_t avg_partition_size = find_avg_partition_size(num_keys);
+        const uint64_t num_partitions = compute_num_partitions(num_keys, avg_partition_size);
+        assert(num_partitions > 0);
+
+        auto start = clock_type::now();
+
+        build_timings timings;
+
+        remove_files();
+        m_seed = config.seed == constants::invalid_seed ? random_value() : config.seed;
+        m_num_keys = num_keys;
+        m_table_size = constants::table_size_per_partition * num_partitions;
+        m_num_partitions = num_partitions;
+        m_avg_partition_size = avg_partition_size;
+        m_num_buckets_per_partition = compute_num_buckets(avg_partition_size, config.lambda);
+        m_bucketer.init(num_partitions);
+        m_partition_seeds.resize(num_partitions);
+        if (num_keys > m_table_size) throw std::runtime_error("too many keys for --dense");
+
+        auto partition_config = config;
+        partition_config.seed = m_seed;
+        partition_config.num_buckets = m_num_buckets_per_partition;
+        partition_config.table_size = constants::table_size_per_partition;
+        partition_config.alpha = 1.0;
+        partition_config.minimal = false;  // free slots are computed over the whole table
+        partition_config.verbose = false;
+        partition_config.num_threads = 1;
+
+        const uint64_t bitmap_taken_bytes = 8 * ((m_table_size + 63) / 64);
+        const uint64_t fixed_bytes = bitmap_taken_bytes + num_partitions * sizeof(uint64_t);
+        if (fixed_bytes >= config.ram) {
+            std::stringstream ss;
+            ss << "not enough RAM available, the bitmap alone takes "
+               << static_cast<double>(bitmap_taken_bytes) / 1'000'000'000 << " GB of space.";
+            throw std::runtime_error(ss.str());
+        }
+        const uint64_t ram = config.ram - fixed_bytes;
+
+        /* number of partitions per range, so that a range is built within the RAM budget */
+        const uint64_t max_partition_size =
+            max_partition_size_estimate(avg_partition_size, num_partitions);
+        const uint64_t partition_bytes =
+            max_partition_size * sizeof(hash_type) +
+            internal_memory_builder_single_phf<hasher_type, Bucketer>::
+                estimate_num_bytes_for_construction(max_partition_size, partition_config);
+        const uint64_t num_partitions_per_range =
+            std::min<uint64_t>(std::max<uint64_t>(ram / partition_bytes, 1), num_partitions);
+        const uint64_t num_ranges =
+            (num_partitions + num_partitions_per_range - 1) / num_partitions_per_range;
+
+        if (config.verbose) {
+            std::cout << "avg_partition_size = " << avg_partition_size << std::endl;
+            std::cout << "num_partitions = " << num_partitions << std::endl;
+            std::cout << "num_buckets_per_partition = " << m_num_buckets_per_partition
+                      << std::endl;
+            std::cout << "num_partitions_per_range = " << num_partitions_per_range << std::endl;
+            std::cout << "num_ranges = " << num_ranges << std::endl;
+            std::cout << "using " << static_cast<double>(config.ram) / 1'000'000'000
+                      << " GB of RAM" << std::endl;
+        }
+
+        const uint64_t run_identifier = clock_type::now().time_since_epoch().count();
+        const std::vector<std::string> dirs = split_tmp_dirs(config.tmp_dir);
+        auto prefix = [&](uint64_t file_id) {  // files are spread round-robin across dirs
+            return dirs[file_id % dirs.size()] + "/pthash.tmp.run" +
+                   std::to_string(run_identifier);
+        };
+
+        std::vector<meta_range> ranges;
+        ranges.reserve(num_ranges);
+        for (uint64_t r = 0; r != num_ranges; ++r) {
+            ranges.emplace_back(prefix(r) + ".range" + std::to_string(r) + ".bin",
+                                config.bypass_page_cache);
+        }
+
+        /* flush the ranges, with one thread per directory */
+        auto flush_ranges = [&]() {
+            const uint64_t num_dirs = std::min<uint64_t>(dirs.size(), num_ranges);
+            if (num_dirs == 1) {
+                for (auto& range : ranges) range.flush();
+                return;
+            }
+            get_thread_pool(config.pool).run(num_dirs, [&](uint64_t d) {
+                for (uint64_t r = d; r < num_ranges; r += num_dirs) ranges[r].flush();
+            });
+        };
+
+        try {
+            /* 1. hash the keys and spill the hash codes by range */
+            {
+                uint64_t bytes = 0;
+                progress_logger logger(num_keys, " == partitioned ", " keys", config.verbose);
+                for (uint64_t i = 0; i != num_keys; ++i, ++keys) {
+                    auto const& key = *keys;
+                    auto hash = hash_key<hasher_type>(key, m_seed);
+                    auto partition = m_bucketer.bucket(hash.mix());
+                    ranges[partition / num_partitions_per_range].push_back(hash);
+                    bytes += sizeof(hash_type);
+                    if (bytes >= ram) {
+                        flush_ranges();
+                        bytes = 0;
+                    }
+                    logger.log();
+                }
+                logger.finalize();
+                flush_ranges();
+                for (auto& range : ranges) range.release();
+            }
+
+            timings.partitioning_microseconds = to_microseconds(clock_type::now() - start);
+
+            /* 2. build the partitions of each range and write their pilots */
+            m_pilots_filename = prefix(0) + ".pilots.bin";
+            std::fstream pilots_out;
+            {
+                std::ofstream truncate(m_pilots_filename.c_str(),
+                                       std::ofstream::binary | std::ofstream::trunc);
+                if (!truncate.is_open()) throw std::runtime_error("cannot open file");
+            }
+            pilots_out.open(m_pilots_filename.c_str(),
+                            std::fstream::in | std::fstream::out | std::fstream::binary);
+            if (!pilots_out.is_open()) throw std::runtime_error("cannot open file");
+
+            bits::bit_vector::builder taken_bvb(m_table_size);
+            std::vector<uint64_t> bumped;            // payloads of the bumped keys
+            std::vector<uint64_t> bumped_positions;  // positions of their pilots in the file
+            uint64_t max_pilot = 0;
+
+            for (uint64_t r = 0; r != num_ranges; ++r) {
+                start = clock_type::now();
+                const uint64_t first = r * num_partitions_per_range;
+                const uint64_t last = std::min(first + num_partitions_per_range, num_partitions);
+                const uint64_t num_partitions_in_range = last - first;
+
+                if (config.verbose) {
+                    std::cout << "processing partitions [" << first << ", " << last << ") of "
+                              << num_partitions << "..." << std::endl;
+                }
+
+                std::vector<std::vector<hash_type>> partitions(num_partitions_in_range);
+                {
+                    mm::file_source<hash_type> range(ranges[r].filename(),
+                                                     mm::advice::sequential);
+                    std::vector<uint64_t> sizes(num_partitions_in_range, 0);
+                    hash_type const* hashes = range.data();
+                    for (uint64_t i = 0; i != range.size(); ++i) {
+                        ++sizes[m_bucketer.bucket(hashes[i].mix()) - first];
+                    }
+                    for (uint64_t i = 0; i != num_partitions_in_range; ++i) {
+                        partitions[i].reserve(sizes[i]);
+                    }
+                    for (uint64_t i = 0; i != range.size(); ++i) {
+                        partitions[m_bucketer.bucket(hashes[i].mix()) - first].push_back(
+                            hashes[i]);
+                    }
+                    range.close();
+                    std::remove(ranges[r].filename().c_str());
+                }
+
+                timings.partitioning_microseconds += to_microseconds(clock_type::now() - start);
+
+                std::vector<internal_memory_builder_single_phf<hasher_type, Bucketer>> builders(
+                    num_partitions_in_range);
+                auto t = internal_memory_builder_partitioned_phf<hasher_type, Bucketer>::
+                    build_partitions(partitions.begin(), builders.begin(), partition_config,
+                                     config.num_threads, num_partitions_in_range);
+                timings.mapping_ordering_microseconds += t.mapping_ordering_microseconds;
+                timings.searching_microseconds += t.searching_microseconds;
+                std::vector<std::vector<hash_type>>().swap(partitions);
+
+                start = clock_type::now();
+                if (r == 0) m_partition_bucketer = builders.front().bucketer();
+
+                for (uint64_t i = 0; i != num_partitions_in_range; ++i) {
+                    auto const& b = builders[i];
+                    const uint64_t partition = first + i;
+                    m_partition_seeds[partition] = b.seed();
+                    auto const& taken = b.taken();
+                    const uint64_t offset = partition * constants::table_size_per_partition;
+                    for (uint64_t p = 0; p != taken.num_bits(); ++p) {
+                        if (taken.get(p)) taken_bvb.set(offset + p, true);
+                    }
+                    bumped.insert(bumped.end(), b.bumped().begin(), b.bumped().end());
+                    auto const& pilots = b.pilots();
+                    for (uint64_t bucket = 0; bucket != pilots.size(); ++bucket) {
+                        if (pilots[bucket] == b.fallback().bumped_pilot()) {
+                            bumped_positions.push_back(bucket * num_partitions + partition);
+                        } else if (pilots[bucket] > max_pilot) {
+                            max_pilot = pilots[bucket];
+                        }
+                    }
+                }
+
+                /* interleaved order: the pilot of bucket j of partition i is at
+                   position j * num_partitions + i */
+                std::vector<uint64_t> row(num_partitions_in_range);
+                for (uint64_t bucket = 0; bucket != m_num_buckets_per_partition; ++bucket) {
+                    for (uint64_t i = 0; i != num_partitions_in_range; ++i) {
+                        row[i] = builders[i].pilots()[bucket];
+                    }
+                    pilots_out.seekp((bucket * num_partitions + first) * sizeof(uint64_t));
+                    pilots_out.write(reinterpret_cast<char const*>(row.data()),
+                                     row.size() * sizeof(uint64_t));
+                }
+                timings.searching_microseconds += to_microseconds(clock_type::now() - start);
+            }
+
+            /* 3. build the fallback function for the bumped keys */
+            start = clock_type::now();
+            if (!bumped.empty()) {
+                if (config.verbose) {
+                    std::cout << bumped.size() << " keys bumped to the fallback function"
+                              << std::endl;
+                }
+                /* as in the internal-memory builder: the smallest value not used as a pilot */
+                const uint64_t bumped_pilot = max_pilot + 1;
+                for (uint64_t position : bumped_positions) {
+                    pilots_out.seekp(position * sizeof(uint64_t));
+                    pilots_out.write(reinterpret_cast<char const*>(&bumped_pilot),
+                                     sizeof(uint64_t));
+                }
+                auto fallback_config = config;
+                fallback_config.max_num_pilot_trials = bumped_pilot;
+                m_fallback.build(bumped, taken_bvb, fallback_config);
+            } else {
+                m_fallback.reset(config);
+            }
+            pilots_out.close();
+            if (pilots_out.fail()) throw std::runtime_error("cannot write pilots to disk");
+            if (config.bypass_page_cache) evict_from_page_cache(m_pilots_filename);
+            m_pilots.open(m_pilots_filename, mm::advice::sequential);
+
+            /* 4. fill the free slots */
+            if (config.minimal and num_keys < m_table_size) {
+                m_free_slots_filename = prefix(1) + ".free_slots.bin";
+                buffered_file_t writer(m_free_slots_filename,
+                                       std::max<uint64_t>(ram / 2, sizeof(uint64_t)));
+                bits::bit_vector taken;
+                taken_bvb.build(taken);
+                fill_free_slots(taken, num_keys, writer, m_table_size);
+                writer.close();
+                if (config.bypass_page_cache) evict_from_page_cache(m_free_slots_filename);
+            }
+            timings.searching_microseconds += to_microseconds(clock_type::now() - start);
+        } catch (...) {
+            for (auto const& range : ranges) std::remove(range.filename().c_str());
+            remove_files();
+            throw;
+        }
+
+        return timings;
+    }
+
+    uint64_t seed() const {
+        return m_seed;
+    }
+
+    uint64_t num_keys() const {
+        return m_num_keys;
+    }
+
+    uint64_t table_size() const {
+        return m_table_size;
+    }
+
+    uint64_t num_partitions() const {
+        return m_num_partitions;
+    }
+
+    uint64_t avg_partition_size() const {
+        return m_avg_partition_size;
+    }
+
+    uint64_t num_buckets_per_partition() const {
+        return m_num_buckets_per_partition;
+    }
+
+    range_bucketer bucketer() const {
+        return m_bucketer;
+    }
+
+    Bucketer partition_bucketer() const {
+        return m_partition_bucketer;
+    }
+
+    uint64_t partition_seed(const uint64_t partition) const {
+        assert(partition < m_num_partitions);
+        return m_partition_seeds[partition];
+    }
+
+    /* The pilots in interleaved order, memory-mapped from disk. */
+    uint64_t const* interleaving_pilots_iterator_begin() const {
+        return m_pilots.data();
+    }
+
+    mm::file_source<uint64_t> free_slots() const {
+        return mm::file_source<uint64_t>(m_free_slots_filename);
+    }
+
+    fallback_builder const& fallback() const {
+        return m_fallback;
+    }
+
+private:
+    void remove_files() {
+        m_pilots.close();
+        if (m_pilots_filename != "") std::remove(m_pilots_filename.c_str());
+        m_pilots_filename = "";
+        if (m_free_slots_filename != "") std::remove(m_free_slots_filename.c_str());
+        m_free_slots_filename = "";
+    }
+
+    uint64_t m_seed;
+    uint64_t m_num_keys;
+    uint64_t m_table_size;
+    uint64_t m_num_partitions;
+    uint64_t m_avg_partition_size;
+    uint64_t m_num_buckets_per_partition;
+
+    range_bucketer m_bucketer;
+    Bucketer m_partition_bucketer;
+    std::vector<uint64_t> m_partition_seeds;
+
+    std::string m_pilots_filename;
+    std::string m_free_slots_filename;
+    mm::file_source<uint64_t> m_pilots;
+
+    fallback_builder m_fallback;
+
+    struct meta_range {
+        meta_range(std::string const& filename, bool bypass_page_cache)
+            : m_filename(filename), m_bypass_page_cache(bypass_page_cache) {
+            /* Truncate the file if it exists from a previous run */
+            std::ofstream truncate(m_filename.c_str(),
+                                   std::ofstream::binary | std::ofstream::trunc);
+            truncate.close();
+        }
+
+        void push_back(hash_type hash) {
+            m_hashes.push_back(hash);
+        }
+
+        std::string const& filename() const {
+            return m_filename;
+        }
+
+        void flush() {
+            if (m_hashes.empty()) return;
+            std::ofstream out(m_filename.c_str(), std::ofstream::binary | std::ofstream::app);
+            if (!out.is_open()) throw std::runtime_error("cannot open file");
+            out.write(reinterpret_cast<char const*>(m_hashes.data()),
+                      m_hashes.size() * sizeof(hash_type));
+            out.close();
+            if (out.fail()) throw std::runtime_error("cannot write file");
+            if (m_bypass_page_cache) evict_from_page_cache(m_filename);
+            m_hashes.clear();
+        }
+
+        void release() {
+            flush();
+            std::vector<hash_type>().swap(m_hashes);
+        }
+
+    private:
+        std::string m_filename;
+        bool m_bypass_page_cache;
+        std::vector<hash_type> m_hashes;
+    };
+
+    struct buffered_file_t {
+        buffered_file_t(std::string const& filename, uint64_t ram)
+            : m_buffer_capacity(ram / sizeof(uint64_t)) {
+            m_out.open(filename, std::ofstream::out | std::ofstream::binary);
+            if (!m_out.is_open()) throw std::runtime_error("cannot open binary file in write mode");
+            m_buffer.reserve(m_buffer_capacity);
+        }
+
+        void emplace_back(const uint64_t value) {
+            m_buffer.push_back(value);
+            if (m_buffer.size() == m_buffer_capacity) flush();
+        }
+
+        void close() {
+            flush();
+            m_out.close();
+        }
+
+    private:
+        void flush() {
+            m_out.write(reinterpret_cast<char const*>(m_buffer.data()),
+                        m_buffer.size() * sizeof(uint64_t));
+            m_buffer.clear();
+        }
+
+        uint64_t m_buffer_capacity;
+        std::vector<uint64_t> m_buffer;
+        std::ofstream m_out;
+    };
+};
+
+}  // namespace pthash
\ No newline at end of file
@@ -1,6 +1,9 @@
 #pragma once
 
+#include <mutex>
+
 #include "builders/util.hpp"
+#include "builders/async_io.hpp"
 #include "mm_file/mm_file.hpp"
 #include "builders/internal_memory_builder_single_phf.hpp"
 #include "builders/internal_memory_builder_partitioned_phf.hpp"
@@ -40,59 +43,85 @@ struct external_memory_builder_partitioned_phf {
         m_num_partitions = num_partitions;
         m_bucketer.init(num_partitions);
         m_offsets.resize(num_partitions);
-        m_builders.init(config.tmp_dir,
-                        static_cast<uint64_t>(clock_type::now().time_since_epoch().count()),
-                        num_partitions);
+        const uint64_t run_identifier = clock_type::now().time_since_epoch().count();
 
-        std::vector<meta_partition> partitions;
-        partitions.reserve(num_partitions);
+        uint64_t bytes = num_partitions * spill_files::bytes_per_partition;
+        if (bytes >= config.ram) throw std::runtime_error("not enough RAM available");
 
-        for (uint64_t partition_id = 0; partition_id != num_partitions; ++partition_id) {
-            partitions.emplace_back(config.tmp_dir, partition_id);
-            partitions.back().reserve(1.5 * avg_partition_size);
+        /* half of the RAM buffers hashes, the other half holds the buffers being written */
+        const uint64_t ram_for_buffers = (config.ram - bytes) / 2;
+        spill_files partitions(config.tmp_dir, run_identifier, num_partitions, ram_for_buffers,
+                               config.bypass_page_cache);
+
+        checkpoint_t checkpoint(config, num_keys, num_partitions, avg_partition_size);
+        const bool resumed = config.checkpoint and checkpoint.load(m_seed, partitions);
+        partitions.keep_files(resumed);
+        m_builders.init(config.tmp_dir, partitions.run_identifier(), num_partitions,
+                        config.bypass_page_cache);
+        m_builders.keep_files(config.checkpoint);
+        if (resumed and config.verbose) {
+            std::cout << "resuming the build from " << checkpoint.manifest_filename()
+                      << std::endl;
         }
 
-        uint64_t bytes = num_partitions * sizeof(meta_partition);
-        if (bytes >= config.ram) throw std::runtime_error("not enough RAM available");
-
-        progress_logger logger(num_keys, " == partitioned ", " keys", config.verbose);
-        for (uint64_t i = 0; i != num_keys; ++i, ++keys) {
-            auto const& key = *keys;
-            auto hash = hasher_type::hash(key, m_seed);
-            auto b = m_bucketer.bucket(hash.mix());
-            partitions[b].push_back(hash);
-            bytes += sizeof(hash_type);
-            if (bytes >= config.ram) {
-                for (auto& partition : partitions) partition.flush();
-                bytes = num_partitions * sizeof(meta_partition);
+        if (resumed) {
+            /* the keys were already partitioned */
+        } else if (config.num_threads > 1) {
+            partitions.reserve(1.5 * avg_partition_size);
+            parallel_hash_and_partition(keys, num_keys, partitions, ram_for_buffers, config);
+        } else {
+            partitions.reserve(1.5 * avg_partition_size);
+            progress_logger logger(num_keys, " == partitioned ", " keys", config.verbose);
+            for (uint64_t i = 0; i != num_keys; ++i, ++keys) {
+                auto const& key = *keys;
+                auto hash = hash_key<hasher_type>(key, m_seed);
+                auto b = m_bucketer.bucket(hash.mix());
+                partitions.push_back(b, hash);
+                bytes += sizeof(hash_type);
+                if (bytes >= ram_for_buffers) {
+                    partitions.flush(0, num_partitions);
+                    bytes = 0;
+                }
+                logger.log();
             }
-            logger.log();
+            logger.finalize();
         }
-        logger.finalize();
 
-        for (auto& partition : partitions) partition.release();
+        partitions.release();
 
         bool failure = false;
         for (uint64_t i = 0, cumulative_size = 0; i != num_partitions; ++i) {
-            auto const& partition = partitions[i];
-            uint64_t table_size = static_cast<double>(partition.size()) / config.alpha;
+            const uint64_t partition_size = partitions.size(i);
+            uint64_t table_size = static_cast<double>(partition_size) / config.alpha;
             m_table_size += table_size;
-            if (partition.size() < 1) {
+            if (partition_size < 1) {
                 failure = true;
                 break;
             }
             m_offsets[i] = cumulative_size;
-            cumulative_size += config.minimal ? partition.size() : table_size;
+            cumulative_size += config.minimal ? partition_size : table_size;
         }
 
         if (failure) {
-            for (uint64_t i = 0; i != num_partitions; ++i) {
-                std::remove(partitions[i].filename().c_str());
-            }
+            partitions.remove_all();
             throw std::runtime_error(
                 "each partition must contain at least one key: use less partitions");
         }
 
+        std::vector<bool> completed(num_partitions, false);
+        if (resumed) {
+            completed = checkpoint.completed();
+        } else if (config.checkpoint) {
+            checkpoint.save(m_seed, partitions);
+            partitions.keep_files(true);  // from now on, the build can be resumed
+        }
+        auto save_builder = [&](internal_memory_builder_single_phf<hasher_type, Bucketer>& b,
+                                const uint64_t partition) {
+            m_builders.save(b, partition);
+            if (config.checkpoint) checkpoint.complete(partition);
+            partitions.remove(partition);
+        };
+
         auto partition_config = config;
         partition_config.seed = m_seed;
         partition_config.num_buckets = compute_num_buckets(avg_partition_size, config.lambda);
@@ -104,8 +133,9 @@ struct external_memory_builder_partitioned_phf {
         if (config.num_threads > 1) {  // parallel
             start = clock_type::now();
 
-            bytes = num_partitions * sizeof(meta_partition);
+            bytes = num_partitions * spill_files::bytes_per_partition;
             std::vector<std::vector<hash_type>> in_memory_partitions;
+            std::vector<uint64_t> in_memory_ids;  // ids of the partitions in memory
             uint64_t i = 0;
 
             auto build_partitions = [&]() {
@@ -115,7 +145,6 @@ struct external_memory_builder_partitioned_phf {
                 }
                 std::vector<internal_memory_builder_single_phf<hasher_type, Bucketer>>
                     in_memory_builders(in_memory_partitions.size());
-                uint64_t id = i - in_memory_partitions.size();
                 auto t = internal_memory_builder_partitioned_phf<
                     hasher_type, Bucketer>::build_partitions(in_memory_partitions.begin(),
                                                              in_memory_builders.begin(),
@@ -124,22 +153,23 @@ struct external_memory_builder_partitioned_phf {
                 timings.mapping_ordering_microseconds += t.mapping_ordering_microseconds;
                 timings.searching_microseconds += t.searching_microseconds;
                 in_memory_partitions.clear();
-                bytes = num_partitions * sizeof(meta_partition);
+                bytes = num_partitions * spill_files::bytes_per_partition;
 
                 if (config.verbose) std::cout << "writing builders to disk..." << std::endl;
 
                 start = clock_type::now();
-                for (auto& builder : in_memory_builders) {
-                    m_builders.save(builder, id);
-                    internal_memory_builder_single_phf<hasher_type, Bucketer>().swap(builder);
-                    ++id;
+                for (uint64_t k = 0; k != in_memory_builders.size(); ++k) {
+                    save_builder(in_memory_builders[k], in_memory_ids[k]);
+                    internal_memory_builder_single_phf<hasher_type, Bucketer>().swap(
+                        in_memory_builders[k]);
                 }
+                in_memory_ids.clear();
                 timings.partitioning_microseconds += to_microseconds(clock_type::now() - start);
-                assert(id == i);
             };
 
             for (; i != num_partitions; ++i) {
-                uint64_t size = partitions[i].size();
+                if (completed[i]) continue;
+                uint64_t size = partitions.size(i);
                 uint64_t partition_bytes = internal_memory_builder_single_phf<
                     hasher_type, Bucketer>::estimate_num_bytes_for_construction(size,
                                                                                 partition_config);
@@ -148,14 +178,10 @@ struct external_memory_builder_partitioned_phf {
                     build_partitions();
                     start = clock_type::now();
                 }
-                std::vector<hash_type> p(size);
-                std::ifstream in(partitions[i].filename().c_str(), std::ifstream::binary);
-                if (!in.is_open()) throw std::runtime_error("cannot open file");
-                in.read(reinterpret_cast<char*>(p.data()),
-                        static_cast<std::streamsize>(size * sizeof(hash_type)));
-                in.close();
-                std::remove(partitions[i].filename().c_str());
+                std::vector<hash_type> p;
+                partitions.read(i, p);
                 in_memory_partitions.push_back(std::move(p));
+                in_memory_ids.push_back(i);
                 bytes += partition_bytes;
             }
             timings.partitioning_microseconds += to_microseconds(clock_type::now() - start);
@@ -165,23 +191,32 @@ struct external_memory_builder_partitioned_phf {
         } else {  // sequential
             internal_memory_builder_single_phf<hasher_type, Bucketer> b;
             for (uint64_t i = 0; i != num_partitions; ++i) {
+                if (completed[i]) continue;
                 if (config.verbose) {
                     std::cout << "processing partition " << i << "/" << num_partitions
                               << " partitions..." << std::endl;
                 }
-                mm::file_source<hash_type> partition(partitions[i].filename(),
-                                                     mm::advice::sequential);
-                auto t = b.build_from_hashes(partition.data(), partition.size(), partition_config);
-                partition.close();
+                mm::file_source<hash_type> segment;
+                std::vector<hash_type> buffer;
+                hash_type const* partition = partitions.data(i, segment, buffer);
+                auto t = internal_memory_builder_partitioned_phf<hasher_type, Bucketer>::
+                    build_partition(partition, partitions.size(i), b, partition_config);
+                segment.close();
                 start = clock_type::now();
-                std::remove(partitions[i].filename().c_str());
-                m_builders.save(b, i);
+                save_builder(b, i);
                 timings.partitioning_microseconds += to_microseconds(clock_type::now() - start);
                 timings.mapping_ordering_microseconds += t.mapping_ordering_microseconds;
                 timings.searching_microseconds += t.searching_microseconds;
             }
         }
 
+        /* the checkpoint is no longer needed once the builders are consumed */
+        m_builders.keep_files(false);
+        if (config.checkpoint) {
+            m_builders.attach(checkpoint.manifest_filename());
+            m_builders.attach(checkpoint.log_filename());
+        }
+
         return timings;
     }
 
@@ -216,12 +251,16 @@ struct external_memory_builder_partitioned_phf {
 private:
     template <typename Builder>
     struct builders_files_manager {
-        builders_files_manager() {}
+        builders_files_manager() : m_num_partitions(0), m_keep_files(false) {}
 
-        void init(std::string const& dir_name, uint64_t run_identifier, uint64_t num_partitions) {
-            m_dir_name = dir_name;
+        void init(std::string const& dir_name, uint64_t run_identifier, uint64_t num_partitions,
+                  bool bypass_page_cache) {
+            m_dir_names = split_tmp_dirs(dir_name);
             m_run_identifier = run_identifier;
             m_num_partitions = num_partitions;
+            m_bypass_page_cache = bypass_page_cache;
+            m_keep_files = false;
+            m_attached_files.clear();
         }
 
         ~builders_files_manager() {
@@ -229,13 +268,27 @@ private:
         }
 
         void close() {
+            if (m_keep_files) return;
             for (uint64_t i = 0; i != m_num_partitions; ++i) {
                 std::remove(get_partition_filename(i).c_str());
             }
+            for (auto const& filename : m_attached_files) std::remove(filename.c_str());
+            m_attached_files.clear();
+        }
+
+        /* Keep the files on disk when closed, e.g., to resume a failed build. */
+        void keep_files(bool keep) {
+            m_keep_files = keep;
+        }
+
+        /* Remove the file together with the builders. */
+        void attach(std::string const& filename) {
+            m_attached_files.push_back(filename);
         }
 
         void save(Builder& builder, uint64_t partition) {
             essentials::save(builder, get_partition_filename(partition).c_str());
+            if (m_bypass_page_cache) evict_from_page_cache(get_partition_filename(partition));
         }
 
         Builder operator[](uint64_t partition) const {
@@ -252,14 +305,17 @@ private:
     private:
         std::string get_partition_filename(uint64_t partition) const {
             std::stringstream filename;
-            filename << m_dir_name << "/pthash.tmp.run" << m_run_identifier << ".partition"
-                     << partition << ".bin";
+            filename << m_dir_names[partition % m_dir_names.size()] << "/pthash.tmp.run"
+                     << m_run_identifier << ".partition" << partition << ".bin";
             return filename.str();
         }
 
-        std::string m_dir_name;
+        std::vector<std::string> m_dir_names;
         uint64_t m_run_identifier;
         uint64_t m_num_partitions;
+        bool m_bypass_page_cache;
+        bool m_keep_files;
+        std::vector<std::string> m_attached_files;
     };
 
 public:
@@ -279,51 +335,466 @@ private:
     std::vector<uint64_t> m_offsets;
     builders_files_manager<internal_memory_builder_single_phf<hasher_type, Bucketer>> m_builders;
 
-    struct meta_partition {
-        meta_partition(std::string const& dir_name, uint64_t id)
-            : m_filename(dir_name + "/pthash.temp." + std::to_string(id)), m_size(0) {
-            /* Truncate the file if it exists from a previous run */
-            std::ofstream truncate(m_filename.c_str(),
-                                   std::ofstream::binary | std::ofstream::trunc);
-            truncate.close();
+    template <typename T>
+    static void write_value(std::ostream& out, T const& value) {
+        out.write(reinterpret_cast<char const*>(&value), sizeof(T));
+    }
+
+    template <typename T>
+    static bool read_value(std::istream& in, T& value) {
+        in.read(reinterpret_cast<char*>(&value), sizeof(T));
+        return bool(in);
+    }
+
+    struct spill_files;
+
+    /*
+        Pipelined partitioning: while the calling thread reads a block of keys,
+        config.num_threads workers hash the previous block. Each worker owns a contiguous
+        range of partitions: it splits the hashes of its slice of the block by owner and
+        routes to its own partitions the hashes that all workers produced for it in the
+        previous round, flushing them to disk when its share of config.ram is exhausted.
+    */
+    template <typename Iterator>
+    void parallel_hash_and_partition(Iterator& keys, const uint64_t num_keys,
+                                     spill_files& partitions, const uint64_t ram_for_buffers,
+                                     build_configuration const& config)  //
+    {
+        typedef std::decay_t<decltype(*keys)> key_type;
+        typedef std::vector<std::vector<std::vector<hash_type>>> split_t;
+
+        const uint64_t num_threads = config.num_threads;
+        const uint64_t num_partitions = partitions.num_partitions();
+        const uint64_t num_partitions_per_thread =
+            (num_partitions + num_threads - 1) / num_threads;
+        const uint64_t block_size = std::min<uint64_t>(num_threads * (1ULL << 16), num_keys);
+        const uint64_t ram_per_thread = ram_for_buffers / num_threads;
+
+        std::vector<key_type> blocks[2];
+        split_t splits[2];
+        for (auto& split : splits) {
+            split.resize(num_threads);
+            for (auto& row : split) row.resize(num_threads);
         }
+        std::vector<uint64_t> bytes(num_threads, 0);
+
+        auto exe = [&](const uint64_t id, std::vector<key_type> const& block, split_t& split,
+                       split_t& previous_split) {
+            /* route the hashes of the previous block to the partitions of this worker */
+            for (auto& row : previous_split) {
+                for (auto const& hash : row[id]) {
+                    partitions.push_back(m_bucketer.bucket(hash.mix()), hash);
+                }
+                bytes[id] += row[id].size() * sizeof(hash_type);
+                row[id].clear();
+            }
+            if (bytes[id] >= ram_per_thread) {
+                const uint64_t begin = std::min(id * num_partitions_per_thread, num_partitions);
+                partitions.flush(begin,
+                                 std::min(begin + num_partitions_per_thread, num_partitions));
+                bytes[id] = 0;
+            }
+            /* hash this worker's slice of the current block */
+            const uint64_t slice_size = (block.size() + num_threads - 1) / num_threads;
+            const uint64_t end = std::min((id + 1) * slice_size, block.size());
+            for (uint64_t i = id * slice_size; i < end; ++i) {
+                auto hash = hash_key<hasher_type>(block[i], m_seed);
+                auto b = m_bucketer.bucket(hash.mix());
+                split[id][b / num_partitions_per_thread].push_back(hash);
+            }
+        };
+
+        progress_logger logger(num_keys, " == partitioned ", " keys", config.verbose);
+        auto read_block = [&](std::vector<key_type>& block, const uint64_t size) {
+            block.clear();
+            block.reserve(size);
+            for (uint64_t i = 0; i != size; ++i, ++keys) {
+                block.push_back(*keys);
+                logger.log();
+            }
+        };
+
+        uint64_t num_read_keys = std::min(block_size, num_keys);
+        read_block(blocks[0], num_read_keys);
+        thread_pool& pool = get_thread_pool(config.pool);
+        for (uint64_t round = 0;; ++round) {
+            /* hash the current block while the next one is being read */
+            auto& block = blocks[round % 2];
+            const bool last_round = block.empty();  // only routes the hashes of the last block
+            auto& split = splits[round % 2];
+            auto& previous_split = splits[(round + 1) % 2];
+            auto workers = pool.async(num_threads, [&](uint64_t id) {
+                exe(id, block, split, previous_split);
+            });
+            // if reading fails, the destructor of workers waits for them
+            auto& next_block = blocks[(round + 1) % 2];
+            const uint64_t size = std::min(block_size, num_keys - num_read_keys);
+            read_block(next_block, size);
+            num_read_keys += size;
+            workers.wait();
+            if (last_round) break;
+        }
+        logger.finalize();
+    }
 
-        void push_back(hash_type hash) {
-            m_hashes.push_back(hash);
+    /*
+        Hash codes spilled to disk. Instead of one file per partition, each flush writes the
+        buffered hashes of a range of partitions, one partition after the other, to a new
+        segment file; an in-memory index records, for each partition, its chunks as
+        (segment, offset, size) triples. A partition written by a single flush is thus
+        a contiguous range of a segment, that is read through a single memory mapping.
+        A segment file is removed as soon as all the partitions it contains are removed.
+    */
+    struct spill_files {
+    private:
+        struct chunk {
+            uint64_t segment, offset, size;
+        };
+
+        struct segment_t {
+            std::string filename;
+            uint64_t num_partitions;  // number of partitions not yet removed
+        };
+
+    public:
+        /* memory used for each partition, besides the buffered hashes */
+        static constexpr uint64_t bytes_per_partition =
+            sizeof(std::vector<hash_type>) + sizeof(std::vector<chunk>) + sizeof(uint64_t);
+
+        spill_files(std::string const& dir_name, uint64_t run_identifier,
+                    uint64_t num_partitions, uint64_t max_pending_bytes, bool bypass_page_cache)
+            : m_dir_names(split_tmp_dirs(dir_name))
+            , m_run_identifier(run_identifier)
+            , m_bypass_page_cache(bypass_page_cache)
+            , m_keep_files(false)
+            , m_buffers(num_partitions)
+            , m_chunks(num_partitions)
+            , m_sizes(num_partitions, 0) {
+            /* segments are spread across the directories, each written by its own thread */
+            for (uint64_t i = 0; i != m_dir_names.size(); ++i) {
+                m_writers.emplace_back(new async_writer(max_pending_bytes / m_dir_names.size()));
+            }
         }
 
-        std::string const& filename() const {
-            return m_filename;
+        ~spill_files() {
+            for (auto& writer : m_writers) {
+                try {
+                    writer->close();
+                } catch (...) {
+                }
+            }
+            if (!m_keep_files) remove_all();
         }
 
-        void flush() {
-            if (m_hashes.empty()) return;
-            m_size += m_hashes.size();
-            std::ofstream out(m_filename.c_str(), std::ofstream::binary | std::ofstream::app);
-            if (!out.is_open()) throw std::runtime_error("cannot open file");
-            out.write(reinterpret_cast<char const*>(m_hashes.data()),
-                      m_hashes.size() * sizeof(hash_type));
-            out.close();
-            m_hashes.clear();
+        uint64_t num_partitions() const {
+            return m_buffers.size();
+        }
+
+        uint64_t run_identifier() const {
+            return m_run_identifier;
+        }
+
+        /* Keep the segments on disk when destroyed, e.g., to resume a failed build. */
+        void keep_files(bool keep) {
+            m_keep_files = keep;
+        }
+
+        /* Write the index of the segments, see load_index. */
+        void save_index(std::ostream& out) const {
+            write_value(out, m_run_identifier);
+            write_value(out, m_segments.size());
+            for (auto const& segment : m_segments) {
+                write_value(out, segment.filename.size());
+                out.write(segment.filename.data(), segment.filename.size());
+                write_value(out, segment.num_partitions);
+            }
+            write_value(out, m_chunks.size());
+            for (uint64_t i = 0; i != m_chunks.size(); ++i) {
+                write_value(out, m_sizes[i]);
+                write_value(out, m_chunks[i].size());
+                out.write(reinterpret_cast<char const*>(m_chunks[i].data()),
+                          m_chunks[i].size() * sizeof(chunk));
+            }
+        }
+
+        /*
+            Restore the index written by save_index, where the partitions marked in 'removed'
+            have been removed meanwhile. Return false, leaving this object unchanged, if the
+            index is malformed or some of the segments still needed are missing.
+        */
+        bool load_index(std::istream& in, std::vector<bool> const& removed) {
+            uint64_t run_identifier = 0, num_segments = 0, num_partitions = 0;
+            if (!read_value(in, run_identifier) or !read_value(in, num_segments)) return false;
+            std::vector<segment_t> segments(num_segments);
+            for (auto& segment : segments) {
+                uint64_t length = 0;
+                if (!read_value(in, length)) return false;
+                segment.filename.resize(length);
+                in.read(&segment.filename[0], length);
+                if (!read_value(in, segment.num_partitions)) return false;
+            }
+            if (!read_value(in, num_partitions) or num_partitions != m_chunks.size() or
+                removed.size() != num_partitions) {
+                return false;
+            }
+            std::vector<std::vector<chunk>> chunks(num_partitions);
+            std::vector<uint64_t> sizes(num_partitions);
+            for (uint64_t i = 0; i != num_partitions; ++i) {
+                uint64_t num_chunks = 0;
+                if (!read_value(in, sizes[i]) or !read_value(in, num_chunks)) return false;
+                chunks[i].resize(num_chunks);
+                in.read(reinterpret_cast<char*>(chunks[i].data()), num_chunks * sizeof(chunk));
+                if (!in) return false;
+                for (auto const& c : chunks[i]) {
+                    if (c.segment >= num_segments) return false;
+                    if (removed[i]) --segments[c.segment].num_partitions;
+                }
+                if (removed[i]) chunks[i].clear();
+            }
+            for (auto const& segment : segments) {
+                if (segment.num_partitions != 0 and !std::ifstream(segment.filename).good()) {
+                    return false;
+                }
+            }
+            for (auto const& segment : segments) {
+                if (segment.num_partitions == 0) std::remove(segment.filename.c_str());
+            }
+            m_run_identifier = run_identifier;
+            m_segments.swap(segments);
+            m_chunks.swap(chunks);
+            m_sizes.swap(sizes);
+            return true;
         }
 
         void reserve(uint64_t n) {
-            m_hashes.reserve(n);
+            for (auto& buffer : m_buffers) buffer.reserve(n);
+        }
+
+        void push_back(uint64_t partition, hash_type hash) {
+            m_buffers[partition].push_back(hash);
+        }
+
+        /*
+            Write the buffered hashes of the partitions in [begin, end) to a new segment,
+            in background. Can be called concurrently on disjoint ranges of partitions.
+        */
+        void flush(uint64_t begin, uint64_t end) {
+            uint64_t num_partitions_in_segment = 0, bytes = 0;
+            for (uint64_t i = begin; i != end; ++i) {
+                if (m_buffers[i].empty()) continue;
+                ++num_partitions_in_segment;
+                bytes += m_buffers[i].size() * sizeof(hash_type);
+            }
+            if (num_partitions_in_segment == 0) return;
+
+            uint64_t segment_id = 0;
+            std::string filename;
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                segment_id = m_segments.size();
+                filename = get_segment_filename(segment_id);
+                m_segments.push_back({filename, num_partitions_in_segment});
+            }
+
+            std::vector<std::vector<hash_type>> buffers;
+            buffers.reserve(num_partitions_in_segment);
+            for (uint64_t i = begin, offset = 0; i != end; ++i) {
+                auto& buffer = m_buffers[i];
+                if (buffer.empty()) continue;
+                m_chunks[i].push_back({segment_id, offset, buffer.size()});
+                m_sizes[i] += buffer.size();
+                offset += buffer.size();
+                buffers.push_back(std::move(buffer));
+                buffer = std::vector<hash_type>();
+            }
+
+            auto& writer = *m_writers[segment_id % m_writers.size()];
+            writer.push(bytes, [filename, evict = m_bypass_page_cache,
+                                buffers = std::move(buffers)]() {
+                std::ofstream out(filename.c_str(), std::ofstream::binary);
+                if (!out.is_open()) throw std::runtime_error("cannot open file");
+                for (auto const& buffer : buffers) {
+                    out.write(reinterpret_cast<char const*>(buffer.data()),
+                              buffer.size() * sizeof(hash_type));
+                }
+                out.close();
+                if (out.fail()) throw std::runtime_error("cannot write file");
+                if (evict) evict_from_page_cache(filename);
+            });
         }
 
+        /* Flush all the partitions and wait until they are written. */
         void release() {
-            flush();
-            std::vector<hash_type>().swap(m_hashes);
+            flush(0, num_partitions());
+            for (auto& writer : m_writers) writer->wait();
+            std::vector<std::vector<hash_type>>().swap(m_buffers);
+        }
+
+        uint64_t size(uint64_t partition) const {
+            return m_sizes[partition];
+        }
+
+        /*
+            Return a pointer to the hashes of the partition: into 'segment' if the
+            partition is made of a single chunk, otherwise into 'buffer'.
+        */
+        hash_type const* data(uint64_t partition, mm::file_source<hash_type>& segment,
+                              std::vector<hash_type>& buffer) const {
+            auto const& chunks = m_chunks[partition];
+            if (chunks.size() == 1) {
+                segment.open(m_segments[chunks.front().segment].filename,
+                             mm::advice::sequential);
+                return segment.data() + chunks.front().offset;
+            }
+            read(partition, buffer);
+            return buffer.data();
+        }
+
+        void read(uint64_t partition, std::vector<hash_type>& hashes) const {
+            hashes.clear();
+            hashes.reserve(m_sizes[partition]);
+            for (auto const& c : m_chunks[partition]) {
+                mm::file_source<hash_type> segment(m_segments[c.segment].filename,
+                                                   mm::advice::sequential);
+                hashes.insert(hashes.end(), segment.data() + c.offset,
+                              segment.data() + c.offset + c.size);
+            }
+        }
+
+        /* The partition is no longer needed: remove the segments left without partitions. */
+        void remove(uint64_t partition) {
+            for (auto const& c : m_chunks[partition]) {
+                auto& segment = m_segments[c.segment];
+                assert(segment.num_partitions > 0);
+                if (--segment.num_partitions == 0) std::remove(segment.filename.c_str());
+            }
+            std::vector<chunk>().swap(m_chunks[partition]);
+        }
+
+        void remove_all() {
+            for (auto& segment : m_segments) {
+                if (segment.num_partitions != 0) std::remove(segment.filename.c_str());
+                segment.num_partitions = 0;
+            }
+        }
+
+    private:
+        std::string get_segment_filename(uint64_t segment_id) const {
+            std::stringstream filename;
+            filename << m_dir_names[segment_id % m_dir_names.size()] << "/pthash.tmp.run"
+                     << m_run_identifier << ".segment" << segment_id << ".bin";
+            return filename.str();
+        }
+
+        std::vector<std::string> m_dir_names;
+        uint64_t m_run_identifier;
+        bool m_bypass_page_cache;
+        bool m_keep_files;
+        std::vector<std::vector<hash_type>> m_buffers;
+        std::vector<std::vector<chunk>> m_chunks;
+        std::vector<uint64_t> m_sizes;
+        std::vector<segment_t> m_segments;
+        std::mutex m_mutex;
+        std::vector<std::unique_ptr<async_writer>> m_writers;
+    };
+
+    /*
+        Checkpoint of a resumable build (config.checkpoint). Once the keys are partitioned,
+        a manifest records the parameters of the build, its seed and the index of the spill
+        files; then, a log records every partition whose builder has been saved.
+        A build with the same parameters and temporary directory resumes from the checkpoint,
+        without reading the keys again and skipping the partitions already built.
+    */
+    struct checkpoint_t {
+        checkpoint_t(build_configuration const& config, const uint64_t num_keys,
+                     const uint64_t num_partitions, const uint64_t avg_partition_size)
+            : m_num_partitions(num_partitions) {
+            uint64_t lambda_bits, alpha_bits;
+            std::memcpy(&lambda_bits, &config.lambda, sizeof(uint64_t));
+            std::memcpy(&alpha_bits, &config.alpha, sizeof(uint64_t));
+            m_params = {version,
+                        num_keys,
+                        num_partitions,
+                        avg_partition_size,
+                        lambda_bits,
+                        alpha_bits,
+                        config.minimal,
+                        config.seed,
+                        config.max_num_pilot_trials,
+                        sizeof(hash_type)};
+            uint64_t fingerprint = 0;
+            for (auto param : m_params) fingerprint = mix(fingerprint ^ param);
+            std::string prefix = split_tmp_dirs(config.tmp_dir).front() + "/pthash.checkpoint." +
+                                 std::to_string(fingerprint);
+            m_manifest_filename = prefix + ".manifest";
+            m_log_filename = prefix + ".log";
         }
 
-        uint64_t size() const {
-            return m_size;
+        /* Return true if the build can be resumed, restoring its seed and spill files. */
+        bool load(uint64_t& seed, spill_files& partitions) const {
+            std::ifstream in(m_manifest_filename.c_str(), std::ifstream::binary);
+            if (!in.is_open()) return false;
+            std::vector<uint64_t> params(m_params.size());
+            in.read(reinterpret_cast<char*>(params.data()), params.size() * sizeof(uint64_t));
+            uint64_t manifest_seed = 0;
+            if (!in or params != m_params or !read_value(in, manifest_seed)) return false;
+            if (!partitions.load_index(in, completed())) return false;
+            seed = manifest_seed;
+            return true;
+        }
+
+        void save(const uint64_t seed, spill_files const& partitions) const {
+            const std::string tmp_filename = m_manifest_filename + ".tmp";
+            std::ofstream out(tmp_filename.c_str(), std::ofstream::binary);
+            if (!out.is_open()) throw std::runtime_error("cannot open checkpoint file");
+            out.write(reinterpret_cast<char const*>(m_params.data()),
+                      m_params.size() * sizeof(uint64_t));
+            write_value(out, seed);
+            partitions.save_index(out);
+            out.close();
+            if (out.fail()) throw std::runtime_error("cannot write checkpoint file");
+            std::remove(m_log_filename.c_str());  // left by a build that did not resume
+            if (std::rename(tmp_filename.c_str(), m_manifest_filename.c_str()) != 0) {
+                throw std::runtime_error("cannot write checkpoint file");
+            }
+        }
+
+        /* The partitions whose builder has been saved. */
+        std::vector<bool> completed() const {
+            std::vector<bool> completed(m_num_partitions, false);
+            std::ifstream in(m_log_filename.c_str(), std::ifstream::binary);
+            uint64_t partition = 0;
+            while (read_value(in, partition)) {
+                if (partition < m_num_partitions) completed[partition] = true;
+            }
+            return completed;
+        }
+
+        void complete(const uint64_t partition) {
+            if (!m_log.is_open()) {
+                m_log.open(m_log_filename.c_str(), std::ofstream::binary | std::ofstream::app);
+            }
+            write_value(m_log, partition);
+            m_log.flush();
+            if (m_log.fail()) throw std::runtime_error("cannot write checkpoint file");
+        }
+
+        std::string const& manifest_filename() const {
+            return m_manifest_filename;
+        }
+
+        std::string const& log_filename() const {
+            return m_log_filename;
         }
 
     private:
-        std::string m_filename;
-        std::vector<hash_type> m_hashes;
-        uint64_t m_size;
+        static constexpr uint64_t version = 1;  // of the format of the manifest
+
+        uint64_t m_num_partitions;
+        std::vector<uint64_t> m_params;
+        std::string m_manifest_filename;
+        std::string m_log_filename;
+        std::ofstream m_log;
     };
 };
 
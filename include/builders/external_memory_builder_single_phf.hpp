@@ -1,7 +1,12 @@
 #pragma once
 
+#include <type_traits>  // is_same_v
+
 #include "builders/util.hpp"
+#include "builders/async_io.hpp"
+#include "builders/paged_bit_vector.hpp"
 #include "builders/search.hpp"
+#include "builders/internal_memory_builder_single_phf.hpp"  // nested builder of the fallback
 #include "mm_file/mm_file.hpp"
 #include "utils/bucketers.hpp"
 #include "utils/logger.hpp"
@@ -63,12 +68,10 @@ struct external_memory_builder_single_phf {
         uint64_t ram = config.ram;
         uint64_t bitmap_taken_bytes = 8 * ((table_size + 63) / 64);
         uint64_t hashed_pilots_cache_bytes = search_cache_size * sizeof(uint64_t);
-        if (bitmap_taken_bytes + hashed_pilots_cache_bytes >= ram) {
-            std::stringstream ss;
-            ss << "not enough RAM available, the bitmap alone takes "
-               << static_cast<double>(bitmap_taken_bytes) / 1'000'000'000 << " GB of space.";
-            throw std::runtime_error(ss.str());
-        }
+        if (hashed_pilots_cache_bytes >= ram) throw std::runtime_error("not enough RAM available");
+        /* a bitmap that does not fit in RAM is paged from a temporary file during search */
+        const bool paged_bitmap = bitmap_taken_bytes + hashed_pilots_cache_bytes >= ram;
+        const uint64_t bitmap_ram = paged_bitmap ? 0 : bitmap_taken_bytes;
 
         if (config.verbose) {
             constexpr uint64_t GB = 1'000'000'000;
@@ -79,15 +82,21 @@ struct external_memory_builder_single_phf {
             std::cout << "num_keys = " << num_keys << std::endl;
             std::cout << "table_size = " << table_size << std::endl;
             std::cout << "num_buckets = " << num_buckets << std::endl;
-            std::cout << "using " << static_cast<double>(ram) / GB << " GB of RAM"
-                      << " (" << static_cast<double>(bitmap_taken_bytes) / GB
-                      << " GB occupied by the bitmap)" << std::endl;
+            std::cout << "using " << static_cast<double>(ram) / GB << " GB of RAM";
+            if (paged_bitmap) {
+                std::cout << " (the bitmap of " << static_cast<double>(bitmap_taken_bytes) / GB
+                          << " GB is paged from disk)" << std::endl;
+            } else {
+                std::cout << " (" << static_cast<double>(bitmap_taken_bytes) / GB
+                          << " GB occupied by the bitmap)" << std::endl;
+            }
             std::cout << "using a peak of " << static_cast<double>(peak) / GB << " GB of disk space"
                       << std::endl;
         }
 
         uint64_t run_identifier = clock_type::now().time_since_epoch().count();
-        temporary_files_manager tfm(config.tmp_dir, run_identifier);
+        temporary_files_manager tfm(config.tmp_dir, run_identifier, config.compress_tmp_files,
+                                    config.bypass_page_cache);
 
         uint64_t num_non_empty_buckets = 0;
 
@@ -104,11 +113,22 @@ struct external_memory_builder_single_phf {
                               << " seconds" << std::endl;
                 }
                 start = clock_type::now();
-                buckets_t buckets = tfm.buckets(config);
-                merge(pairs_blocks, buckets, config.verbose);
-                buckets.flush();
+                uint64_t num_threads = config.num_threads;
+                if (pairs_blocks.size() == 1 or
+                    config.ram / num_threads < 2 * sizeof(uint64_t) * (MAX_BUCKET_SIZE + 1)) {
+                    num_threads = 1;
+                }
+                auto buckets = tfm.buckets(config, num_threads);
+                if (num_threads > 1) {
+                    merge_parallel(pairs_blocks, buckets, get_thread_pool(config.pool));
+                } else {
+                    merge(pairs_blocks, buckets.front(), config.verbose);
+                }
+                for (auto& b : buckets) {
+                    b.flush();
+                    num_non_empty_buckets += b.num_buckets();
+                }
                 for (auto& pairs_block : pairs_blocks) pairs_block.close();
-                num_non_empty_buckets = buckets.num_buckets();
                 tfm.remove_all_pairs_files();
                 stop = clock_type::now();
                 if (config.verbose) {
@@ -131,27 +151,37 @@ struct external_memory_builder_single_phf {
             throw;
         }
 
-        try {
-            auto start = clock_type::now();
-            bits::bit_vector::builder taken_bvb(m_table_size);
-
+        auto search_and_fill_free_slots = [&](auto& taken) {
             {  // search
                 auto buckets_iterator = tfm.buckets_iterator();
 
-                // write all bucket-pilot pairs to files
-                uint64_t ram_for_pilots = ram - bitmap_taken_bytes - hashed_pilots_cache_bytes;
-                auto pilots =
-                    tfm.get_multifile_pairs_writer(num_non_empty_buckets, ram_for_pilots, 1, 0);
-
-                search(m_num_keys, m_num_buckets, num_non_empty_buckets,  //
-                       config, buckets_iterator, taken_bvb, pilots);
+                auto search_and_bump = [&](auto& pilots) {
+                    std::vector<uint64_t> bumped;
+                    search(m_num_keys, m_num_buckets, num_non_empty_buckets,  //
+                           config, buckets_iterator, taken, pilots, bumped);
+                    m_fallback.build(bumped, taken, config);
+                };
 
-                pilots.flush();
-                buckets_iterator.close();
-                // merge all sorted bucket-pilot pairs on a single file, saving only the pilot
-                pilots_merger_t pilots_merger(tfm.get_pilots_filename(), ram);
-                merge(tfm.pairs_blocks(), pilots_merger, false);
-                pilots_merger.finalize_and_close(m_num_buckets);
+                uint64_t ram_for_pilots = ram - bitmap_ram - hashed_pilots_cache_bytes;
+                if (m_num_buckets * sizeof(uint64_t) <= ram_for_pilots) {
+                    // the pilots fit in RAM: store them directly in bucket-id order
+                    pilots_array_t pilots(m_num_buckets);
+                    search_and_bump(pilots);
+                    buckets_iterator.close();
+                    pilots.save(tfm.get_pilots_filename());
+                } else {
+                    // write all bucket-pilot pairs to files
+                    auto pilots =
+                        tfm.get_multifile_pairs_writer(num_non_empty_buckets, ram_for_pilots, 1, 0);
+                    search_and_bump(pilots);
+                    pilots.flush();
+                    buckets_iterator.close();
+                    // merge all sorted bucket-pilot pairs on a single file, saving only the pilot
+                    pilots_merger_t pilots_merger(tfm.get_pilots_filename(), ram, m_num_buckets);
+                    merge(tfm.pairs_blocks(), pilots_merger, false);
+                    pilots_merger.finalize_and_close();
+                }
+                if (config.bypass_page_cache) evict_from_page_cache(tfm.get_pilots_filename());
 
                 if (m_pilots_filename != "") std::remove(m_pilots_filename.c_str());
                 m_pilots_filename = tfm.get_pilots_filename();
@@ -163,15 +193,31 @@ struct external_memory_builder_single_phf {
 
             if (config.minimal and num_keys < table_size) {  // fill free slots
                 // write all free slots to file
-                buffered_file_t<uint64_t> writer(tfm.get_free_slots_filename(),
-                                                 ram - bitmap_taken_bytes);
-                bits::bit_vector taken;
-                taken_bvb.build(taken);
-                fill_free_slots(taken, num_keys, writer, table_size);
+                buffered_file_t<uint64_t> writer(tfm.get_free_slots_filename(), ram - bitmap_ram);
+                if constexpr (std::is_same_v<std::decay_t<decltype(taken)>, paged_bit_vector>) {
+                    taken.advise_sequential();
+                    fill_free_slots(taken, num_keys, writer, table_size);
+                } else {
+                    bits::bit_vector taken_bv;
+                    taken.build(taken_bv);
+                    fill_free_slots(taken_bv, num_keys, writer, table_size);
+                }
                 writer.close();
+                if (config.bypass_page_cache) evict_from_page_cache(tfm.get_free_slots_filename());
                 if (m_free_slots_filename != "") std::remove(m_free_slots_filename.c_str());
                 m_free_slots_filename = tfm.get_free_slots_filename();
             }
+        };
+
+        try {
+            auto start = clock_type::now();
+            if (paged_bitmap) {
+                paged_bit_vector taken(tfm.get_taken_filename(), m_table_size);
+                search_and_fill_free_slots(taken);
+            } else {
+                bits::bit_vector::builder taken(m_table_size);
+                search_and_fill_free_slots(taken);
+            }
 
             auto stop = clock_type::now();
             time.searching_microseconds = to_microseconds(stop - start);
@@ -192,6 +238,11 @@ struct external_memory_builder_single_phf {
         return m_seed;
     }
 
+    /* Keys are never re-salted by this builder. */
+    uint64_t salt() const {
+        return constants::invalid_seed;
+    }
+
     uint64_t num_keys() const {
         return m_num_keys;
     }
@@ -220,6 +271,10 @@ struct external_memory_builder_single_phf {
         return mm::file_source<uint64_t>(m_free_slots_filename);
     }
 
+    fallback_builder const& fallback() const {
+        return m_fallback;
+    }
+
 private:
     uint64_t m_seed;
     uint64_t m_num_keys;
@@ -231,6 +286,8 @@ private:
     std::string m_pilots_filename;
     std::string m_free_slots_filename;
 
+    fallback_builder m_fallback;
+
     template <typename T>
     struct buffer_t {
         buffer_t(uint64_t ram) : m_buffer_capacity(ram / sizeof(T)) {
@@ -241,10 +298,33 @@ private:
         template <class... _Args>
         void emplace_back(_Args&&... __args) {
             m_buffer.emplace_back(std::forward<_Args>(__args)...);
-            if (--m_buffer_capacity == 0) flush();
+            if (--m_buffer_capacity == 0) flush_buffer();
         }
 
+        /* Flush the buffer and wait until its content is on disk. */
         void flush() {
+            flush_buffer();
+            sync();
+        }
+
+    protected:
+        virtual void flush_impl(std::vector<T>& buffer) = 0;
+        virtual void sync() {}
+
+        /*
+            Hand over the content of the buffer to an async_writer,
+            leaving the buffer empty but with the same capacity.
+        */
+        static void write_async(async_writer& writer, std::ofstream& out,
+                                std::vector<T>& buffer) {
+            const uint64_t capacity = buffer.capacity();
+            writer.write(out, std::move(buffer));
+            buffer = std::vector<T>();
+            buffer.reserve(capacity);
+        }
+
+    private:
+        void flush_buffer() {
             if (!m_buffer.empty()) {
                 uint64_t buffer_size = m_buffer.size();
                 flush_impl(m_buffer);
@@ -253,33 +333,41 @@ private:
             }
         }
 
-    protected:
-        virtual void flush_impl(std::vector<T>& buffer) = 0;
-
     private:
         uint64_t m_buffer_capacity;
         std::vector<T> m_buffer;
     };
 
+    /*
+        Double-buffered file: half of the RAM is used to fill a buffer
+        while the other half is being written in background.
+    */
     template <typename T>
     struct buffered_file_t : buffer_t<T> {
-        buffered_file_t(std::string const& filename, uint64_t ram) : buffer_t<T>(ram) {
+        buffered_file_t(std::string const& filename, uint64_t ram)
+            : buffer_t<T>(std::max<uint64_t>(ram / 2, sizeof(T))), m_writer(ram / 2) {
             m_out.open(filename, std::ofstream::out | std::ofstream::binary);
             if (!m_out.is_open()) throw std::runtime_error("cannot open binary file in write mode");
         }
 
         void close() {
             buffer_t<T>::flush();
+            m_writer.close();
             m_out.close();
         }
 
     protected:
         void flush_impl(std::vector<T>& buffer) {
-            m_out.write(reinterpret_cast<char const*>(buffer.data()), buffer.size() * sizeof(T));
+            buffer_t<T>::write_async(m_writer, m_out, buffer);
+        }
+
+        void sync() {
+            m_writer.wait();
         }
 
     private:
         std::ofstream m_out;
+        async_writer m_writer;  // destroyed before m_out
     };
 
     template <typename T>
@@ -307,14 +395,172 @@ private:
         T *m_begin, *m_end;
     };
 
-    template <typename T>
-    struct reader_t : memory_view<const T> {
-        void open(std::string const& filename) {
+    /*
+        Sorted runs of pairs are optionally compressed (config.compress_tmp_files).
+        Since the pairs are sorted by decreasing bucket id, each bucket id is coded as the
+        varint-encoded difference with the previous one, followed by the 8 bytes of the payload.
+        A compressed file starts with the number of pairs it holds.
+    */
+    struct pairs_codec {
+        template <typename ByteOutput>
+        static void encode(bucket_payload_pair const& pair, uint64_t& prev, ByteOutput& out) {
+            assert(pair.bucket_id <= prev);
+            uint64_t delta = prev - pair.bucket_id;
+            prev = pair.bucket_id;
+            while (delta >= 0x80) {
+                out.emplace_back(static_cast<uint8_t>(delta | 0x80));
+                delta >>= 7;
+            }
+            out.emplace_back(static_cast<uint8_t>(delta));
+            for (uint64_t i = 0; i != sizeof(uint64_t); ++i) {
+                out.emplace_back(static_cast<uint8_t>(pair.payload >> (8 * i)));
+            }
+        }
+
+        static bucket_payload_pair decode(uint8_t const*& in, uint64_t& prev) {
+            uint64_t delta = 0;
+            for (uint64_t shift = 0; true; shift += 7) {
+                uint8_t byte = *in++;
+                delta |= static_cast<uint64_t>(byte & 0x7F) << shift;
+                if (byte < 0x80) break;
+            }
+            prev -= delta;
+            uint64_t payload;
+            std::memcpy(&payload, in, sizeof(uint64_t));
+            in += sizeof(uint64_t);
+            return bucket_payload_pair(prev, payload);
+        }
+
+        static constexpr uint64_t first_prev = std::numeric_limits<bucket_id_type>::max();
+    };
+
+    /* A sorted run of pairs read from a temporary file, compressed or not. */
+    struct pairs_t {
+        struct const_iterator {
+            typedef std::forward_iterator_tag iterator_category;
+            typedef bucket_payload_pair value_type;
+            typedef std::ptrdiff_t difference_type;
+            typedef bucket_payload_pair const* pointer;
+            typedef bucket_payload_pair const& reference;
+
+            const_iterator(uint8_t const* data, uint8_t const* data_end, uint64_t pos,
+                           uint64_t size, bool compressed)
+                : m_data(data)
+                , m_data_end(data_end)
+                , m_read_ahead_end(data)
+                , m_pos(pos)
+                , m_size(size)
+                , m_prev(pairs_codec::first_prev)
+                , m_compressed(compressed) {
+                read();
+            }
+
+            reference operator*() const {
+                return m_pair;
+            }
+
+            void operator++() {
+                ++m_pos;
+                read();
+            }
+
+            bool operator==(const_iterator const& other) const {
+                return m_pos == other.m_pos;
+            }
+
+            bool operator!=(const_iterator const& other) const {
+                return m_pos != other.m_pos;
+            }
+
+        private:
+            static constexpr uint64_t read_ahead_bytes = 4 * 1024 * 1024;
+
+            void read() {
+                if (m_pos >= m_size) return;
+                if (uint64_t(m_read_ahead_end - m_data) <= read_ahead_bytes / 2) {
+                    advance_read_ahead();
+                }
+                if (m_compressed) {
+                    m_pair = pairs_codec::decode(m_data, m_prev);
+                } else {
+                    std::memcpy(&m_pair, m_data, sizeof(bucket_payload_pair));
+                    m_data += sizeof(bucket_payload_pair);
+                }
+            }
+
+            /*
+                Keep the next read_ahead_bytes bytes being loaded by the kernel: several
+                iterators may be reading different ranges of the same file at once.
+            */
+            void advance_read_ahead() {
+                if (m_read_ahead_end == m_data_end) return;
+                uint8_t const* end = uint64_t(m_data_end - m_data) > read_ahead_bytes
+                                         ? m_data + read_ahead_bytes
+                                         : m_data_end;
+                read_ahead(std::max(m_read_ahead_end, m_data), end);
+                m_read_ahead_end = end;
+            }
+
+            uint8_t const* m_data;
+            uint8_t const* m_data_end;
+            uint8_t const* m_read_ahead_end;
+            uint64_t m_pos;
+            uint64_t m_size;
+            uint64_t m_prev;
+            bool m_compressed;
+            bucket_payload_pair m_pair;
+        };
+
+        pairs_t() : m_size(0), m_compressed(false) {}
+
+        void open(std::string const& filename, bool compressed) {
             if (m_is.is_open()) m_is.close();
             m_is.open(filename, mm::advice::sequential);
             if (!m_is.is_open()) throw std::runtime_error("cannot open temporary file (read)");
-            memory_view<const T>::m_begin = m_is.data();
-            memory_view<const T>::m_end = m_is.data() + m_is.size();
+            m_compressed = compressed;
+            if (m_compressed) {
+                assert(m_is.size() >= sizeof(uint64_t));
+                std::memcpy(&m_size, m_is.data(), sizeof(uint64_t));
+            } else {
+                m_size = m_is.size() / sizeof(bucket_payload_pair);
+            }
+        }
+
+        const_iterator begin() const {
+            uint8_t const* data = m_is.data();
+            if (m_compressed) data += sizeof(uint64_t);
+            return const_iterator(data, data_end(), 0, m_size, m_compressed);
+        }
+
+        const_iterator end() const {
+            return const_iterator(nullptr, nullptr, m_size, m_size, m_compressed);
+        }
+
+        /*
+            Iterators to the pairs in positions 0, stride, 2 * stride, ...: their bucket ids
+            sample the distribution of the run and they are starting points from which to
+            reach any pair in at most 'stride' steps. A compressed run is decoded once.
+        */
+        std::vector<const_iterator> samples(const uint64_t stride) const {
+            assert(stride > 0);
+            std::vector<const_iterator> result;
+            result.reserve((m_size + stride - 1) / stride);
+            if (m_compressed) {
+                auto it = begin();
+                for (uint64_t pos = 0; pos < m_size; ++pos, ++it) {
+                    if (pos % stride == 0) result.push_back(it);
+                }
+            } else {
+                for (uint64_t pos = 0; pos < m_size; pos += stride) {
+                    result.emplace_back(m_is.data() + pos * sizeof(bucket_payload_pair),
+                                        data_end(), pos, m_size, m_compressed);
+                }
+            }
+            return result;
+        }
+
+        uint64_t size() const {
+            return m_size;
         }
 
         void close() {
@@ -322,13 +568,37 @@ private:
         }
 
     private:
-        mm::file_source<T> m_is;
+        uint8_t const* data_end() const {
+            return m_is.data() + m_is.size();
+        }
+
+        mm::file_source<uint8_t> m_is;
+        uint64_t m_size;
+        bool m_compressed;
     };
 
-    typedef reader_t<bucket_payload_pair> pairs_t;
+    /* Compressed run of pairs written to file, see pairs_codec. */
+    struct compressed_pairs_file_t : buffered_file_t<uint8_t> {
+        compressed_pairs_file_t(std::string const& filename, uint64_t ram, uint64_t num_pairs)
+            : buffered_file_t<uint8_t>(filename, ram), m_prev(pairs_codec::first_prev) {
+            for (uint64_t i = 0; i != sizeof(uint64_t); ++i) {
+                buffered_file_t<uint8_t>::emplace_back(static_cast<uint8_t>(num_pairs >> (8 * i)));
+            }
+        }
+
+        void emplace_back(bucket_id_type bucket_id, uint64_t payload) {
+            buffered_file_t<uint8_t>& bytes = *this;
+            pairs_codec::encode(bucket_payload_pair(bucket_id, payload), m_prev, bytes);
+        }
+
+    private:
+        uint64_t m_prev;
+    };
 
+    template <typename PairsFile>
     struct pairs_merger_t {
-        pairs_merger_t(std::string const& filename, uint64_t ram) : m_buffer(filename, ram) {}
+        template <typename... Args>
+        pairs_merger_t(Args&&... args) : m_buffer(std::forward<Args>(args)...) {}
 
         template <typename HashIterator>
         void add(bucket_id_type bucket_id, bucket_size_type bucket_size, HashIterator hashes) {
@@ -342,20 +612,28 @@ private:
         }
 
     private:
-        buffered_file_t<bucket_payload_pair> m_buffer;
+        PairsFile m_buffer;
     };
 
     struct buckets_t {  // merger
-        buckets_t(std::vector<std::string> const& filenames, uint64_t ram,
-                  std::vector<bool>& used_bucket_sizes)
+        buckets_t(std::vector<std::string> const& filenames, std::vector<uint64_t> const& devices,
+                  uint64_t num_devices, uint64_t ram, std::vector<bool>& used_bucket_sizes,
+                  bool bypass_page_cache)
             : m_filenames(filenames)
+            , m_devices(devices)
             , m_buffers(filenames.size())
             , m_buffer_capacity(ram / (sizeof(uint64_t) * 2))
             , m_ram(ram / (sizeof(uint64_t) * 2))
             , m_used_bucket_sizes(used_bucket_sizes)
             , m_outs(filenames.size())
-            , m_num_buckets(0) {
+            , m_num_buckets(0)
+            , m_bypass_page_cache(bypass_page_cache) {
             assert(m_filenames.size() == m_used_bucket_sizes.size());
+            assert(m_devices.size() == m_filenames.size());
+            /* one writer per device, so that the devices are written in parallel */
+            for (uint64_t i = 0; i != num_devices; ++i) {
+                m_writers.emplace_back(new async_writer(m_ram * sizeof(uint64_t) / num_devices));
+            }
             m_non_empty_buckets.reserve(filenames.size());
             for (uint64_t i = 0; i != filenames.size(); ++i) {
                 if (m_used_bucket_sizes[i]) {
@@ -383,6 +661,7 @@ private:
         void flush() {
             for (uint64_t i = 0; i != m_buffers.size(); ++i) flush_i(i);
             m_non_empty_buckets.clear();
+            for (auto& writer : m_writers) writer->wait();
         }
 
     private:
@@ -410,13 +689,25 @@ private:
                 }
                 m_used_bucket_sizes[i] = true;
             }
-            m_outs[i].write(reinterpret_cast<char const*>(m_buffers[i].data()),
-                            m_buffers[i].size() * sizeof(uint64_t));
             m_buffer_capacity += m_buffers[i].size();
+            auto& writer = *m_writers[m_devices[i]];
+            if (m_bypass_page_cache) {
+                const uint64_t bytes = m_buffers[i].size() * sizeof(uint64_t);
+                writer.push(bytes, [&out = m_outs[i], &filename = m_filenames[i], bytes,
+                                    buffer = std::move(m_buffers[i])]() {
+                    out.write(reinterpret_cast<char const*>(buffer.data()), bytes);
+                    out.flush();
+                    if (out.fail()) throw std::runtime_error("cannot write temporary file");
+                    evict_from_page_cache(filename);
+                });
+            } else {
+                writer.write(m_outs[i], std::move(m_buffers[i]));
+            }
             std::vector<uint64_t>().swap(m_buffers[i]);
         }
 
         std::vector<std::string> m_filenames;
+        std::vector<uint64_t> m_devices;
         std::vector<std::vector<uint64_t>> m_buffers;
         uint64_t m_buffer_capacity;
         uint64_t m_ram;
@@ -424,17 +715,24 @@ private:
         std::vector<bool>& m_used_bucket_sizes;
         std::vector<std::ofstream> m_outs;
         uint64_t m_num_buckets;
+        bool m_bypass_page_cache;
+        std::vector<std::unique_ptr<async_writer>> m_writers;  // half of the RAM, in flight
     };
 
     struct buckets_iterator_t {
         buckets_iterator_t(
-            std::vector<std::pair<bucket_size_type, std::string>> const& sizes_filenames)
-            : m_sizes(sizes_filenames.size()), m_sources(sizes_filenames.size()) {
+            std::vector<std::pair<bucket_size_type, std::string>> const& sizes_filenames,
+            bool bypass_page_cache)
+            : m_sizes(sizes_filenames.size())
+            , m_filenames(sizes_filenames.size())
+            , m_sources(sizes_filenames.size())
+            , m_bypass_page_cache(bypass_page_cache) {
             m_pos = sizes_filenames.size();
             for (uint64_t i = 0, i_end = m_pos; i < i_end; ++i) {
                 m_sizes[i] = sizes_filenames[i].first;
+                m_filenames[i] = sizes_filenames[i].second;
                 m_sources[i].open(sizes_filenames[i].second, mm::advice::sequential);
-                assert(i == 0 or m_sizes[i - 1] < m_sizes[i]);
+                assert(i == 0 or m_sizes[i - 1] <= m_sizes[i]);
             }
             read_next_file();
         }
@@ -451,11 +749,20 @@ private:
 
         void operator++() {
             m_it += m_bucket_size + 1;
-            if (m_it >= m_end) read_next_file();
+            if (m_it >= m_end) {
+                read_next_file();
+            } else if (m_it + read_ahead_words / 2 >= m_read_ahead_end) {
+                advance_read_ahead();
+            }
         }
 
     private:
+        static constexpr uint64_t read_ahead_words = (8 * 1024 * 1024) / sizeof(uint64_t);
+
         void read_next_file() {
+            if (m_bypass_page_cache and m_pos < m_sources.size()) {  // the file is consumed
+                evict_consumed(m_filenames[m_pos], m_sources[m_pos].data(), m_evicted_end, m_end);
+            }
             if (m_pos == 0) {
                 m_it = m_end;
                 return;
@@ -464,19 +771,77 @@ private:
             m_bucket_size = m_sizes[m_pos];
             m_it = m_sources[m_pos].data();
             m_end = m_it + m_sources[m_pos].size();
+            m_read_ahead_end = m_it;
+            m_evicted_end = m_it;
+            advance_read_ahead();
+        }
+
+        /*
+            Keep the next read_ahead_words words of the file being loaded by the kernel
+            and, if required, evict the words already consumed from the page cache.
+        */
+        void advance_read_ahead() {
+            uint64_t const* end =
+                uint64_t(m_end - m_it) > read_ahead_words ? m_it + read_ahead_words : m_end;
+            if (end <= m_read_ahead_end) return;
+            read_ahead(m_read_ahead_end, end);
+            m_read_ahead_end = end;
+            if (m_bypass_page_cache and m_it > m_evicted_end) {
+                evict_consumed(m_filenames[m_pos], m_sources[m_pos].data(), m_evicted_end, m_it);
+                m_evicted_end = m_it;
+            }
         }
 
         uint64_t m_pos;
         std::vector<bucket_size_type> m_sizes;
+        std::vector<std::string> m_filenames;
         std::vector<mm::file_source<uint64_t>> m_sources;
+        bool m_bypass_page_cache;
+        uint64_t const* m_evicted_end;
         bucket_size_type m_bucket_size;
         uint64_t const* m_it;
         uint64_t const* m_end;
+        uint64_t const* m_read_ahead_end;
+    };
+
+    /*
+        Collects the pilots directly in bucket-id order, when they all fit in RAM,
+        so that the bucket-pilot pairs need not be sorted and merged.
+    */
+    struct pilots_array_t {
+        pilots_array_t(uint64_t num_buckets) : m_pilots(num_buckets, 0) {}
+
+        void emplace_back(bucket_id_type bucket_id, uint64_t pilot) {
+            assert(bucket_id < m_pilots.size());
+            m_pilots[bucket_id] = pilot;
+        }
+
+        void save(std::string const& filename) const {
+            std::ofstream out(filename, std::ofstream::out | std::ofstream::binary);
+            if (!out.is_open()) throw std::runtime_error("cannot open binary file in write mode");
+            out.write(reinterpret_cast<char const*>(m_pilots.data()),
+                      m_pilots.size() * sizeof(uint64_t));
+            if (out.fail()) throw std::runtime_error("cannot write temporary file");
+        }
+
+    private:
+        std::vector<uint64_t> m_pilots;
     };
 
+    /*
+        Writes the pilots to file in bucket-id order. The pairs come sorted by decreasing
+        bucket id (see bucket_payload_pair::operator<), so the pilots are buffered from the
+        last bucket backwards and every full buffer is written at its own offset in the file.
+    */
     struct pilots_merger_t {
-        pilots_merger_t(std::string const& filename, uint64_t ram)
-            : m_buffer(filename, ram), m_next_bucket_id(0) {}
+        pilots_merger_t(std::string const& filename, uint64_t ram, uint64_t num_buckets)
+            : m_capacity(std::max<uint64_t>(ram / 2 / sizeof(uint64_t), 1))
+            , m_next_bucket_id(num_buckets)
+            , m_writer(ram / 2) {
+            m_out.open(filename, std::ofstream::out | std::ofstream::binary);
+            if (!m_out.is_open()) throw std::runtime_error("cannot open binary file in write mode");
+            m_buffer.reserve(m_capacity);
+        }
 
         template <typename HashIterator>
         void add(bucket_id_type bucket_id, bucket_size_type bucket_size, HashIterator hashes) {
@@ -485,31 +850,65 @@ private:
             emplace_back_and_fill(bucket_id, *hashes);
         }
 
-        void finalize_and_close(uint64_t num_buckets) {
-            if (m_next_bucket_id < num_buckets) emplace_back_and_fill(num_buckets - 1, 0);
-            m_buffer.close();
+        void finalize_and_close() {
+            if (m_next_bucket_id > 0) emplace_back_and_fill(0, 0);
+            flush();
+            m_writer.close();
+            m_out.close();
         }
 
     private:
         inline void emplace_back_and_fill(bucket_id_type bucket_id, uint64_t pilot) {
-            assert(m_next_bucket_id <= bucket_id);
-            while (m_next_bucket_id++ < bucket_id) m_buffer.emplace_back(0);
-            m_buffer.emplace_back(pilot);
+            assert(bucket_id < m_next_bucket_id);
+            while (--m_next_bucket_id > bucket_id) emplace_back(0);
+            emplace_back(pilot);
+        }
+
+        inline void emplace_back(uint64_t pilot) {
+            m_buffer.push_back(pilot);
+            if (m_buffer.size() == m_capacity) flush();
         }
 
-        buffered_file_t<uint64_t> m_buffer;
+        /* the buffer holds the pilots of buckets m_next_bucket_id, m_next_bucket_id + 1, ...
+           in reverse order */
+        void flush() {
+            if (m_buffer.empty()) return;
+            std::reverse(m_buffer.begin(), m_buffer.end());
+            const uint64_t offset = m_next_bucket_id * sizeof(uint64_t);
+            const uint64_t bytes = m_buffer.size() * sizeof(uint64_t);
+            std::vector<uint64_t> buffer;
+            buffer.reserve(m_capacity);
+            buffer.swap(m_buffer);
+            auto& out = m_out;
+            m_writer.push(bytes, [&out, offset, bytes, buffer = std::move(buffer)]() {
+                out.seekp(offset);
+                out.write(reinterpret_cast<char const*>(buffer.data()), bytes);
+                if (out.fail()) throw std::runtime_error("cannot write temporary file");
+            });
+        }
+
+        uint64_t m_capacity;
         uint64_t m_next_bucket_id;
+        std::vector<uint64_t> m_buffer;
+        std::ofstream m_out;
+        async_writer m_writer;  // destroyed before m_out
     };
 
     struct multifile_pairs_writer : buffer_t<bucket_payload_pair> {
         multifile_pairs_writer(std::vector<std::string> const& filenames, uint64_t& num_pairs_files,
-                               uint64_t num_pairs, uint64_t ram, uint64_t num_threads_sort = 1,
-                               uint64_t ram_parallel_merge = 0)
-            : buffer_t<bucket_payload_pair>(get_balanced_ram(num_pairs, ram))
+                               bool compressed, bool bypass_page_cache, uint64_t num_pairs,
+                               uint64_t ram, uint64_t num_threads_sort = 1,
+                               uint64_t ram_parallel_merge = 0, thread_pool* pool = nullptr)
+            : buffer_t<bucket_payload_pair>(
+                  get_balanced_ram(num_pairs, buffer_ram(ram, num_threads_sort)))
             , m_filenames(filenames)
             , m_num_pairs_files(num_pairs_files)
+            , m_compressed(compressed)
+            , m_bypass_page_cache(bypass_page_cache)
             , m_num_threads_sort(num_threads_sort)
-            , m_ram_parallel_merge(ram_parallel_merge) {
+            , m_ram_parallel_merge(ram_parallel_merge)
+            , m_pool(pool)
+            , m_writer(buffer_ram(ram, num_threads_sort)) {
             assert(num_threads_sort > 1 or ram_parallel_merge == 0);
         }
 
@@ -532,34 +931,88 @@ private:
                     std::sort(blocks[tid].begin(), blocks[tid].end());
                 };
 
-                std::vector<std::thread> threads(m_num_threads_sort);
-                for (uint64_t i = 0; i != m_num_threads_sort; ++i) {
-                    threads[i] = std::thread(exe, i);
-                }
-                for (uint64_t i = 0; i != m_num_threads_sort; ++i) {
-                    if (threads[i].joinable()) threads[i].join();
-                }
-                pairs_merger_t pairs_merger(m_filenames[m_num_pairs_files], m_ram_parallel_merge);
+                get_thread_pool(m_pool).run(m_num_threads_sort, exe);
+                std::string filename = m_filenames[m_num_pairs_files];
                 ++m_num_pairs_files;
-                merge(blocks, pairs_merger, false);
-                pairs_merger.close();
-            } else {  // sequential
-                std::ofstream out(m_filenames[m_num_pairs_files],
-                                  std::ofstream::out | std::ofstream::binary);
-                if (!out.is_open()) throw std::runtime_error("cannot open temporary file (write)");
+                if (m_compressed) {
+                    pairs_merger_t<compressed_pairs_file_t> pairs_merger(
+                        filename, m_ram_parallel_merge, size);
+                    merge(blocks, pairs_merger, false);
+                    pairs_merger.close();
+                } else {
+                    pairs_merger_t<buffered_file_t<bucket_payload_pair>> pairs_merger(
+                        filename, m_ram_parallel_merge);
+                    merge(blocks, pairs_merger, false);
+                    pairs_merger.close();
+                }
+                if (m_bypass_page_cache) evict_from_page_cache(filename);
+            } else {  // sequential: sort, then write (and compress) in background
+                std::string filename = m_filenames[m_num_pairs_files];
                 ++m_num_pairs_files;
                 std::sort(buffer.begin(), buffer.end());
-                out.write(reinterpret_cast<char const*>(buffer.data()),
-                          size * sizeof(bucket_payload_pair));
-                out.close();
+                const uint64_t capacity = buffer.capacity();
+                auto write = [filename, compressed = m_compressed, evict = m_bypass_page_cache,
+                              sorted = std::move(buffer)]() {
+                    std::ofstream out(filename, std::ofstream::out | std::ofstream::binary);
+                    if (!out.is_open()) {
+                        throw std::runtime_error("cannot open temporary file (write)");
+                    }
+                    if (compressed) {
+                        write_compressed(out, sorted);
+                    } else {
+                        out.write(reinterpret_cast<char const*>(sorted.data()),
+                                  sorted.size() * sizeof(bucket_payload_pair));
+                    }
+                    if (out.fail()) throw std::runtime_error("cannot write temporary file");
+                    out.close();
+                    if (evict) evict_from_page_cache(filename);
+                };
+                m_writer.push(size * sizeof(bucket_payload_pair), std::move(write));
+                buffer = std::vector<bucket_payload_pair>();
+                buffer.reserve(capacity);
+            }
+        }
+
+        void sync() {
+            m_writer.wait();
+        }
+
+        static void write_compressed(std::ofstream& out,
+                                     std::vector<bucket_payload_pair> const& sorted) {
+            static constexpr uint64_t chunk_bytes = 1 << 20;
+            std::vector<uint8_t> chunk;
+            chunk.reserve(chunk_bytes + sizeof(uint64_t) + 10);
+            const uint64_t num_pairs = sorted.size();
+            out.write(reinterpret_cast<char const*>(&num_pairs), sizeof(uint64_t));
+            uint64_t prev = pairs_codec::first_prev;
+            for (auto const& pair : sorted) {
+                pairs_codec::encode(pair, prev, chunk);
+                if (chunk.size() >= chunk_bytes) {
+                    out.write(reinterpret_cast<char const*>(chunk.data()), chunk.size());
+                    chunk.clear();
+                }
             }
+            out.write(reinterpret_cast<char const*>(chunk.data()), chunk.size());
+        }
+
+    public:
+        /*
+            RAM for the buffer of pairs: when sorting sequentially,
+            the other half holds the sorted buffer being written in background.
+        */
+        static uint64_t buffer_ram(uint64_t ram, uint64_t num_threads_sort) {
+            return num_threads_sort > 1 ? ram : ram / 2;
         }
 
     private:
         std::vector<std::string> m_filenames;
         uint64_t& m_num_pairs_files;
+        bool m_compressed;
+        bool m_bypass_page_cache;
         uint64_t m_num_threads_sort;
         uint64_t m_ram_parallel_merge;
+        thread_pool* m_pool;
+        async_writer m_writer;
 
         static uint64_t get_balanced_ram(uint64_t num_pairs, uint64_t ram) {
             uint64_t num_pairs_per_file = ram / sizeof(bucket_payload_pair);
@@ -576,18 +1029,22 @@ private:
     };
 
     struct temporary_files_manager {
-        temporary_files_manager(std::string const& dir_name, uint64_t run_identifier)
-            : m_dir_name(dir_name)
+        temporary_files_manager(std::string const& dir_name, uint64_t run_identifier,
+                                bool compressed, bool bypass_page_cache)
+            : m_dir_names(split_tmp_dirs(dir_name))
             , m_run_identifier(run_identifier)
+            , m_compressed(compressed)
+            , m_bypass_page_cache(bypass_page_cache)
             , m_num_pairs_files(0)
-            , m_used_bucket_sizes(MAX_BUCKET_SIZE) {
-            std::fill(m_used_bucket_sizes.begin(), m_used_bucket_sizes.end(), false);
-        }
+            , m_used_bucket_sizes(1, std::vector<bool>(MAX_BUCKET_SIZE, false)) {}
 
         multifile_pairs_writer get_multifile_pairs_writer(uint64_t num_pairs, uint64_t ram,
                                                           uint64_t num_threads_sort = 1,
-                                                          uint64_t ram_parallel_merge = 0) {
-            uint64_t num_pairs_per_file = ram / sizeof(bucket_payload_pair);
+                                                          uint64_t ram_parallel_merge = 0,
+                                                          thread_pool* pool = nullptr) {
+            uint64_t num_pairs_per_file =
+                multifile_pairs_writer::buffer_ram(ram, num_threads_sort) /
+                sizeof(bucket_payload_pair);
             uint64_t num_temporary_files =
                 (num_pairs + num_pairs_per_file - 1) / num_pairs_per_file;
             std::vector<std::string> filenames;
@@ -595,8 +1052,9 @@ private:
             for (uint64_t i = 0; i < num_temporary_files; ++i) {
                 filenames.emplace_back(get_pairs_filename(m_num_pairs_files + i));
             }
-            return multifile_pairs_writer(filenames, m_num_pairs_files, num_pairs, ram,
-                                          num_threads_sort, ram_parallel_merge);
+            return multifile_pairs_writer(filenames, m_num_pairs_files, m_compressed,
+                                          m_bypass_page_cache, num_pairs, ram, num_threads_sort,
+                                          ram_parallel_merge, pool);
         }
 
         uint64_t get_num_pairs_files() const {
@@ -610,59 +1068,93 @@ private:
         }
 
         void remove_all_merge_files() {
-            for (uint64_t i = 0; i != MAX_BUCKET_SIZE; ++i) {
-                if (m_used_bucket_sizes[i]) {
-                    std::remove(get_buckets_filename(i + 1).c_str());
-                    m_used_bucket_sizes[i] = false;
+            for (uint64_t part = 0; part != m_used_bucket_sizes.size(); ++part) {
+                for (uint64_t i = 0; i != MAX_BUCKET_SIZE; ++i) {
+                    if (m_used_bucket_sizes[part][i]) {
+                        std::remove(get_buckets_filename(i + 1, part).c_str());
+                        m_used_bucket_sizes[part][i] = false;
+                    }
                 }
             }
         }
 
         std::vector<pairs_t> pairs_blocks() const {
             std::vector<pairs_t> result(m_num_pairs_files);
-            for (uint64_t i = 0; i != m_num_pairs_files; ++i) result[i].open(get_pairs_filename(i));
+            for (uint64_t i = 0; i != m_num_pairs_files; ++i) {
+                result[i].open(get_pairs_filename(i), m_compressed);
+            }
             return result;
         };
 
-        buckets_t buckets(build_configuration const& config) {
-            std::vector<std::string> filenames;
-            filenames.reserve(MAX_BUCKET_SIZE);
-            for (uint64_t bucket_size = 1; bucket_size <= MAX_BUCKET_SIZE; ++bucket_size) {
-                filenames.emplace_back(get_buckets_filename(bucket_size));
+        /*
+            The buckets are written in 'num_parts' parts, each with its own files and sharing
+            the RAM: part p receives buckets of larger ids than part p + 1, so that reading
+            the parts in order gives the buckets of each size in decreasing order of id.
+        */
+        std::vector<buckets_t> buckets(build_configuration const& config,
+                                       const uint64_t num_parts = 1) {
+            assert(num_parts > 0);
+            m_used_bucket_sizes.resize(num_parts, std::vector<bool>(MAX_BUCKET_SIZE, false));
+            std::vector<buckets_t> result;
+            result.reserve(num_parts);
+            for (uint64_t part = 0; part != num_parts; ++part) {
+                std::vector<std::string> filenames;
+                filenames.reserve(MAX_BUCKET_SIZE);
+                std::vector<uint64_t> devices;
+                devices.reserve(MAX_BUCKET_SIZE);
+                for (uint64_t bucket_size = 1; bucket_size <= MAX_BUCKET_SIZE; ++bucket_size) {
+                    filenames.emplace_back(get_buckets_filename(bucket_size, part));
+                    devices.push_back((bucket_size + part) % m_dir_names.size());
+                }
+                result.emplace_back(filenames, devices, m_dir_names.size(), config.ram / num_parts,
+                                    m_used_bucket_sizes[part], m_bypass_page_cache);
             }
-            return buckets_t(filenames, config.ram, m_used_bucket_sizes);
+            return result;
         }
 
         buckets_iterator_t buckets_iterator() {
             std::vector<std::pair<bucket_size_type, std::string>> sizes_filenames;
             for (uint64_t i = 0; i != MAX_BUCKET_SIZE; ++i) {
-                if (m_used_bucket_sizes[i]) {
-                    uint64_t bucket_size = i + 1;
-                    sizes_filenames.emplace_back(bucket_size, get_buckets_filename(bucket_size));
+                // the iterator starts from the back
+                for (uint64_t part = m_used_bucket_sizes.size(); part-- > 0;) {
+                    if (m_used_bucket_sizes[part][i]) {
+                        uint64_t bucket_size = i + 1;
+                        sizes_filenames.emplace_back(bucket_size,
+                                                     get_buckets_filename(bucket_size, part));
+                    }
                 }
             }
             assert(sizes_filenames.size() > 0);
-            return buckets_iterator_t(sizes_filenames);
+            return buckets_iterator_t(sizes_filenames, m_bypass_page_cache);
         }
 
         bucket_size_type max_bucket_size() {
             bucket_size_type bucket_size = 0;
-            for (uint64_t i = 0, i_end = m_used_bucket_sizes.size(); i < i_end; ++i) {
-                if (m_used_bucket_sizes[i]) bucket_size = i;
+            for (auto const& used_bucket_sizes : m_used_bucket_sizes) {
+                for (uint64_t i = 0, i_end = used_bucket_sizes.size(); i < i_end; ++i) {
+                    if (used_bucket_sizes[i]) bucket_size = std::max<uint64_t>(bucket_size, i);
+                }
             }
             return bucket_size + 1;
         }
 
         std::string get_pilots_filename() const {
             std::stringstream filename;
-            filename << m_dir_name << "/pthash.tmp.run" << m_run_identifier << ".pilots"
+            filename << dir_name(0) << "/pthash.tmp.run" << m_run_identifier << ".pilots"
+                     << ".bin";
+            return filename.str();
+        }
+
+        std::string get_taken_filename() const {
+            std::stringstream filename;
+            filename << dir_name(2) << "/pthash.tmp.run" << m_run_identifier << ".taken"
                      << ".bin";
             return filename.str();
         }
 
         std::string get_free_slots_filename() const {
             std::stringstream filename;
-            filename << m_dir_name << "/pthash.tmp.run" << m_run_identifier << ".free_slots"
+            filename << dir_name(1) << "/pthash.tmp.run" << m_run_identifier << ".free_slots"
                      << ".bin";
             return filename.str();
         }
@@ -670,24 +1162,90 @@ private:
     private:
         std::string get_pairs_filename(uint32_t file_id) const {
             std::stringstream filename;
-            filename << m_dir_name << "/pthash.tmp.run" << m_run_identifier << ".pairs" << file_id
-                     << ".bin";
+            filename << dir_name(file_id) << "/pthash.tmp.run" << m_run_identifier << ".pairs"
+                     << file_id << ".bin";
             return filename.str();
         }
 
-        std::string get_buckets_filename(bucket_size_type bucket_size) const {
+        std::string get_buckets_filename(bucket_size_type bucket_size, uint64_t part) const {
             std::stringstream filename;
-            filename << m_dir_name << "/pthash.tmp.run" << m_run_identifier << ".size"
-                     << static_cast<uint32_t>(bucket_size) << ".bin";
+            filename << dir_name(bucket_size + part) << "/pthash.tmp.run" << m_run_identifier
+                     << ".size" << static_cast<uint32_t>(bucket_size) << ".part" << part
+                     << ".bin";
             return filename.str();
         }
 
-        std::string m_dir_name;
+        /* files are spread round-robin across the temporary directories */
+        std::string const& dir_name(uint64_t file_id) const {
+            return m_dir_names[file_id % m_dir_names.size()];
+        }
+
+        std::vector<std::string> m_dir_names;
         uint64_t m_run_identifier;
+        bool m_compressed;
+        bool m_bypass_page_cache;
         uint64_t m_num_pairs_files;
-        std::vector<bool> m_used_bucket_sizes;
+        std::vector<std::vector<bool>> m_used_bucket_sizes;  // one per part
     };
 
+    /*
+        Merges the sorted runs with one thread per merger. The bucket-id space is split into
+        ranges holding about the same number of pairs, using splitters sampled from the runs:
+        the t-th thread merges the t-th range (in decreasing order of bucket id) of every run
+        into the t-th merger, so that a bucket is never split across threads.
+    */
+    template <typename Merger>
+    static void merge_parallel(std::vector<pairs_t> const& pairs_blocks,
+                               std::vector<Merger>& mergers, thread_pool& pool) {
+        typedef typename pairs_t::const_iterator iterator;
+        const uint64_t num_threads = mergers.size();
+        const uint64_t num_blocks = pairs_blocks.size();
+        uint64_t num_pairs = 0;
+        for (auto const& pairs : pairs_blocks) num_pairs += pairs.size();
+        const uint64_t stride = std::max<uint64_t>(num_pairs / (num_threads * 256), 1);
+
+        // sample the runs (compressed runs are decoded, so in parallel)
+        std::vector<std::vector<iterator>> samples(num_blocks);
+        pool.run(num_threads, [&](uint64_t t) {
+            for (uint64_t i = t; i < num_blocks; i += num_threads) {
+                samples[i] = pairs_blocks[i].samples(stride);
+            }
+        });
+
+        std::vector<bucket_id_type> sampled_ids;
+        for (auto const& block_samples : samples) {
+            for (auto const& it : block_samples) sampled_ids.push_back((*it).bucket_id);
+        }
+        std::sort(sampled_ids.begin(), sampled_ids.end(), std::greater<bucket_id_type>());
+
+        /* range t holds the pairs with splitters[t + 1] <= bucket_id < splitters[t] */
+        std::vector<std::vector<iterator>> begins(num_threads + 1);
+        for (uint64_t i = 0; i != num_blocks; ++i) {
+            begins[0].push_back(pairs_blocks[i].begin());
+            begins[num_threads].push_back(pairs_blocks[i].end());
+        }
+        for (uint64_t t = 1; t != num_threads; ++t) {
+            const bucket_id_type splitter = sampled_ids[t * sampled_ids.size() / num_threads];
+            for (uint64_t i = 0; i != num_blocks; ++i) {
+                // start from the last sample not smaller than the splitter
+                iterator it = pairs_blocks[i].begin();
+                for (auto const& sample : samples[i]) {
+                    if ((*sample).bucket_id < splitter) break;
+                    it = sample;
+                }
+                auto end = pairs_blocks[i].end();
+                while (it != end and (*it).bucket_id >= splitter) ++it;
+                begins[t].push_back(it);
+            }
+        }
+        samples.clear();
+
+        pool.run(num_threads, [&](uint64_t t) {
+            progress_logger logger(0, "", "", false);
+            merge_ranges(begins[t], begins[t + 1], mergers[t], logger);
+        });
+    }
+
     template <typename Iterator>
     void map(Iterator keys, uint64_t num_keys, std::vector<pairs_t>& pairs_blocks,
              temporary_files_manager& tfm, build_configuration const& config) {
@@ -703,11 +1261,11 @@ private:
         }
 
         auto writer = tfm.get_multifile_pairs_writer(num_keys, ram - ram_parallel_merge,
-                                                     num_threads, ram_parallel_merge);
+                                                     num_threads, ram_parallel_merge, config.pool);
         try {
             for (uint64_t i = 0; i != num_keys; ++i, ++keys) {
                 auto const& key = *keys;
-                auto hash = hasher_type::hash(key, m_seed);
+                auto hash = hash_key<hasher_type>(key, m_seed);
                 bucket_id_type bucket_id = m_bucketer.bucket(hash.first());
                 writer.emplace_back(bucket_id, hash.second());
                 logger.log();
@@ -0,0 +1,161 @@
+#pragma once
+
+#include "builders/util.hpp"
+#include "utils/bucketers.hpp"
+#include "utils/hasher.hpp"
+
+namespace pthash {
+
+template <typename Hasher, typename Bucketer>
+struct internal_memory_builder_single_phf;
+
+/*
+    Secondary function for the keys of "bumped" buckets, i.e., buckets for which
+    search gave up after config.max_num_pilot_trials pilots (see search.hpp).
+    It is a small PHF built over the bumped payloads, whose positions are
+    redirected to the slots left free by the primary search.
+*/
+struct fallback_builder {
+    fallback_builder()
+        : m_bumped_pilot(constants::unbounded_num_pilot_trials)
+        , m_seed(constants::invalid_seed)
+        , m_salt(constants::invalid_seed)
+        , m_num_keys(0)
+        , m_table_size(0) {}
+
+    /*
+        Assign to the bumped payloads the first free slots in 'taken'
+        (so that, for a minimal function, they do not require to be remapped)
+        and mark them as taken.
+    */
+    template <typename Taken, typename NestedBuilder =
+                                  internal_memory_builder_single_phf<xxhash_64, range_bucketer>>
+    void build(std::vector<uint64_t> const& bumped, Taken& taken,
+               build_configuration const& config)  //
+    {
+        reset(config);
+        m_num_keys = bumped.size();
+        if (m_num_keys == 0) return;
+
+        build_configuration nested_config;
+        nested_config.lambda = config.lambda;
+        nested_config.minimal = false;
+        nested_config.verbose = false;
+        nested_config.num_threads = 1;
+
+        NestedBuilder builder;
+        builder.build_from_keys(bumped.begin(), m_num_keys, nested_config);
+        m_seed = builder.seed();
+        m_salt = builder.salt();
+        m_table_size = builder.table_size();
+        m_bucketer = builder.bucketer();
+        m_pilots = builder.pilots();
+        assert(m_table_size >= m_num_keys);
+
+        /* positions of the nested function that are not used by any key keep slot 0 */
+        m_slots.resize(m_table_size, 0);
+        auto const& nested_taken = builder.taken();
+        for (uint64_t p = 0, slot = 0; p != m_table_size; ++p) {
+            if (!nested_taken.get(p)) continue;
+            while (taken.get(slot)) {
+                ++slot;
+                assert(slot < taken.num_bits());
+            }
+            taken.set(slot, true);
+            m_slots[p] = slot;
+        }
+    }
+
+    /* Empty function: only records the pilot value reserved to mark bumped buckets. */
+    void reset(build_configuration const& config) {
+        m_bumped_pilot = config.max_num_pilot_trials;
+        m_seed = constants::invalid_seed;
+        m_salt = constants::invalid_seed;
+        m_num_keys = 0;
+        m_table_size = 0;
+        m_bucketer.init(0);
+        m_pilots.clear();
+        m_slots.clear();
+    }
+
+    void set_bumped_pilot(const uint64_t pilot) {
+        m_bumped_pilot = pilot;
+    }
+
+    uint64_t bumped_pilot() const {
+        return m_bumped_pilot;
+    }
+
+    uint64_t seed() const {
+        return m_seed;
+    }
+
+    uint64_t salt() const {
+        return m_salt;
+    }
+
+    uint64_t num_keys() const {
+        return m_num_keys;
+    }
+
+    uint64_t table_size() const {
+        return m_table_size;
+    }
+
+    range_bucketer bucketer() const {
+        return m_bucketer;
+    }
+
+    std::vector<uint64_t> const& pilots() const {
+        return m_pilots;
+    }
+
+    std::vector<uint64_t> const& slots() const {
+        return m_slots;
+    }
+
+    void swap(fallback_builder& other) {
+        std::swap(m_bumped_pilot, other.m_bumped_pilot);
+        std::swap(m_seed, other.m_seed);
+        std::swap(m_salt, other.m_salt);
+        std::swap(m_num_keys, other.m_num_keys);
+        std::swap(m_table_size, other.m_table_size);
+        m_bucketer.swap(other.m_bucketer);
+        m_pilots.swap(other.m_pilots);
+        m_slots.swap(other.m_slots);
+    }
+
+    template <typename Visitor>
+    void visit(Visitor& visitor) const {
+        visit_impl(visitor, *this);
+    }
+
+    template <typename Visitor>
+    void visit(Visitor& visitor) {
+        visit_impl(visitor, *this);
+    }
+
+private:
+    template <typename Visitor, typename T>
+    static void visit_impl(Visitor& visitor, T&& t) {
+        visitor.visit(t.m_bumped_pilot);
+        visitor.visit(t.m_seed);
+        visitor.visit(t.m_salt);
+        visitor.visit(t.m_num_keys);
+        visitor.visit(t.m_table_size);
+        visitor.visit(t.m_bucketer);
+        visitor.visit(t.m_pilots);
+        visitor.visit(t.m_slots);
+    }
+
+    uint64_t m_bumped_pilot;
+    uint64_t m_seed;
+    uint64_t m_salt;
+    uint64_t m_num_keys;
+    uint64_t m_table_size;
+    range_bucketer m_bucketer;
+    std::vector<uint64_t> m_pilots;
+    std::vector<uint64_t> m_slots;
+};
+
+}  // namespace pthash
\ No newline at end of file
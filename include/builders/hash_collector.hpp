@@ -0,0 +1,228 @@
+#pragma once
+
+#include <mutex>
+
+#include "builders/util.hpp"
+#include "mm_file/mm_file.hpp"
+
+namespace pthash {
+
+/*
+    Collects the keys added concurrently by several threads, e.g., each reading its own shard
+    of the input, so that they need not be gathered in a single container before a build.
+    Each thread adds its keys through its own producer, that hashes them into a local
+    buffer and hands the full buffers (chunks) over to the collector. The chunks are spilled
+    to a temporary file in config.tmp_dir when they exceed config.ram.
+
+    Once all the keys are added, finalize() returns a random-access iterator over them, as
+    prehashed keys: the builders accept them in place of the original keys, provided that
+    they are configured with the seed of the collector, e.g.,
+
+        hash_collector<xxhash_64> collector(config);
+        (on each thread) auto producer = collector.get_producer(); producer.add(key); ...
+        config.seed = collector.seed();
+        builder.build_from_keys(collector.finalize(), collector.size(), config);
+*/
+template <typename Hasher>
+struct hash_collector {
+    typedef typename Hasher::hash_type hash_type;
+    static constexpr uint64_t log2_chunk_size = 16;
+    static constexpr uint64_t chunk_size = uint64_t(1) << log2_chunk_size;
+
+    hash_collector(build_configuration const& config)
+        : m_seed(config.seed == constants::invalid_seed ? random_value() : config.seed)
+        , m_ram(config.ram)
+        , m_filename(split_tmp_dirs(config.tmp_dir).front() + "/pthash.tmp.run" +
+                     std::to_string(clock_type::now().time_since_epoch().count()) +
+                     ".hashes.bin")
+        , m_size(0)
+        , m_num_spilled_chunks(0)
+        , m_finalized(false) {}
+
+    hash_collector(hash_collector const&) = delete;
+    hash_collector& operator=(hash_collector const&) = delete;
+
+    ~hash_collector() {
+        m_file.close();
+        if (m_num_spilled_chunks != 0) std::remove(m_filename.c_str());
+    }
+
+    /* The seed the keys are hashed with: the build must use the same seed. */
+    uint64_t seed() const {
+        return m_seed;
+    }
+
+    /* Number of keys added by the producers flushed so far. */
+    uint64_t size() const {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_size;
+    }
+
+    /* Adds keys on behalf of a single thread. Not thread-safe: use one per thread. */
+    struct producer {
+        producer(hash_collector& collector) : m_collector(&collector) {
+            m_buffer.reserve(chunk_size);
+        }
+
+        producer(producer&&) = default;
+        producer& operator=(producer&&) = delete;
+
+        ~producer() {
+            if (m_collector) m_collector->add_hashes(m_buffer, false);
+        }
+
+        template <typename Key>
+        void add(Key const& key) {
+            m_buffer.push_back(Hasher::hash(key, m_collector->m_seed));
+            if (m_buffer.size() == chunk_size) m_collector->add_hashes(m_buffer, true);
+        }
+
+        template <typename Iterator>
+        void add_batch(Iterator begin, Iterator end) {
+            for (; begin != end; ++begin) add(*begin);
+        }
+
+        /* Hand over the buffered keys to the collector, as the destructor does. */
+        void flush() {
+            m_collector->add_hashes(m_buffer, true);
+        }
+
+    private:
+        hash_collector* m_collector;
+        std::vector<hash_type> m_buffer;
+    };
+
+    producer get_producer() {
+        return producer(*this);
+    }
+
+    /* Thread-safe. */
+    template <typename Iterator>
+    void add_batch(Iterator begin, Iterator end) {
+        producer p(*this);
+        p.add_batch(begin, end);
+        p.flush();
+    }
+
+    struct iterator {
+        using value_type = prehashed_key<hash_type>;
+        using difference_type = std::ptrdiff_t;
+        using pointer = value_type*;
+        using reference = value_type&;
+        using iterator_category = std::random_access_iterator_tag;
+
+        iterator(hash_type const* const* chunks, uint64_t seed, uint64_t pos)
+            : m_chunks(chunks), m_seed(seed), m_pos(pos) {}
+
+        inline value_type operator*() const {
+            return (*this)[0];
+        }
+
+        inline value_type operator[](uint64_t i) const {
+            const uint64_t pos = m_pos + i;
+            return {m_chunks[pos >> log2_chunk_size][pos & (chunk_size - 1)], m_seed};
+        }
+
+        inline iterator& operator++() {
+            ++m_pos;
+            return *this;
+        }
+
+        inline iterator operator+(uint64_t offset) const {
+            return iterator(m_chunks, m_seed, m_pos + offset);
+        }
+
+    private:
+        hash_type const* const* m_chunks;
+        uint64_t m_seed;
+        uint64_t m_pos;
+    };
+
+    /*
+        Signal the end of the input: all the producers must have been flushed or destroyed.
+        Return an iterator over the size() collected keys.
+    */
+    iterator finalize() {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (!m_finalized) {
+            /* all the chunks are full but the last one */
+            if (!m_tail.empty()) m_chunks.push_back(std::move(m_tail));
+            const uint64_t bytes = m_chunks.size() * chunk_size * sizeof(hash_type);
+            if (m_num_spilled_chunks != 0 or bytes > m_ram) {
+                spill(m_chunks);
+                std::vector<std::vector<hash_type>>().swap(m_chunks);
+                m_file.close();
+                m_spilled.open(m_filename);
+                for (uint64_t i = 0; i != m_num_spilled_chunks; ++i) {
+                    m_chunk_pointers.push_back(m_spilled.data() + i * chunk_size);
+                }
+            } else {
+                for (auto const& chunk : m_chunks) m_chunk_pointers.push_back(chunk.data());
+            }
+            m_finalized = true;
+        }
+        return iterator(m_chunk_pointers.data(), m_seed, 0);
+    }
+
+private:
+    uint64_t m_seed;
+    uint64_t m_ram;
+    std::string m_filename;
+    mutable std::mutex m_mutex;
+    std::mutex m_file_mutex;  // serializes the writes to the temporary file
+    uint64_t m_size;
+    std::vector<std::vector<hash_type>> m_chunks;  // in memory, all full
+    std::vector<hash_type> m_tail;                 // not full
+    std::ofstream m_file;
+    uint64_t m_num_spilled_chunks;
+    mm::file_source<hash_type> m_spilled;
+    std::vector<hash_type const*> m_chunk_pointers;
+    bool m_finalized;
+
+    void add_hashes(std::vector<hash_type>& buffer, const bool may_spill) {
+        if (buffer.empty()) return;
+        std::vector<std::vector<hash_type>> to_spill;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (m_finalized) throw std::runtime_error("keys added after finalize()");
+            m_size += buffer.size();
+            if (buffer.size() == chunk_size) {
+                m_chunks.push_back(std::move(buffer));
+            } else {
+                for (auto const& hash : buffer) {
+                    m_tail.push_back(hash);
+                    if (m_tail.size() == chunk_size) {
+                        m_chunks.push_back(std::move(m_tail));
+                        m_tail.clear();
+                    }
+                }
+            }
+            if (may_spill and m_chunks.size() * chunk_size * sizeof(hash_type) >= m_ram) {
+                to_spill.swap(m_chunks);
+            }
+        }
+        buffer.clear();
+        buffer.reserve(chunk_size);
+        /* the other producers keep adding keys meanwhile */
+        if (!to_spill.empty()) {
+            std::lock_guard<std::mutex> lock(m_file_mutex);
+            spill(to_spill);
+        }
+    }
+
+    /* Append the chunks to the temporary file: all are full but the last one spilled. */
+    void spill(std::vector<std::vector<hash_type>> const& chunks) {
+        if (m_num_spilled_chunks == 0) {
+            m_file.open(m_filename.c_str(), std::ofstream::binary);
+            if (!m_file.good()) throw std::runtime_error("cannot open file '" + m_filename + "'");
+        }
+        for (auto const& chunk : chunks) {
+            m_file.write(reinterpret_cast<char const*>(chunk.data()),
+                         chunk.size() * sizeof(hash_type));
+            ++m_num_spilled_chunks;
+        }
+        if (!m_file.good()) throw std::runtime_error("cannot write to '" + m_filename + "'");
+    }
+};
+
+}  // namespace pthash
\ No newline at end of file
@@ -1,5 +1,7 @@
 #pragma once
 
+#include <numeric>  // iota
+
 #include "builders/util.hpp"
 #include "builders/internal_memory_builder_single_phf.hpp"
 
@@ -10,7 +12,7 @@ struct internal_memory_builder_partitioned_phf {
     typedef Hasher hasher_type;
     typedef Bucketer bucketer_type;
 
-    template <typename Iterator>
+    template <typename Iterator, bool CheckDuplicates = true>
     build_timings build_from_keys(Iterator keys, const uint64_t num_keys,
                                   build_configuration const& config)  //
     {
@@ -58,82 +60,65 @@ struct internal_memory_builder_partitioned_phf {
             std::cout << "table_size_per_partition = " << partition_config.table_size << std::endl;
         }
 
-        const int max_num_attempts = 10;
-        for (int attempt = 0; attempt < max_num_attempts; ++attempt)  //
-        {
-            if (attempt == 0 and config.seed != constants::invalid_seed) {
-                m_seed = config.seed;
-            } else {
-                m_seed = random_value();
-            }
+        m_seed = config.seed == constants::invalid_seed ? random_value() : config.seed;
 
+        if (is_random_access_iterator<Iterator> or config.num_threads > 1) {
+            parallel_hash_and_partition(keys, partitions, num_keys, config.num_threads, m_seed,
+                                        num_partitions, m_bucketer, get_thread_pool(config.pool));
+        } else {
             auto it = keys;
-            if constexpr (std::is_same_v<typename Iterator::iterator_category,
-                                         std::random_access_iterator_tag>) {
-                parallel_hash_and_partition(it, partitions, num_keys, config.num_threads, m_seed,
-                                            num_partitions, m_bucketer);
-            } else {
-                for (uint64_t i = 0; i != num_keys; ++i, ++it) {
-                    auto const& key = *it;
-                    auto hash = hasher_type::hash(key, m_seed);
-                    auto b = m_bucketer.bucket(hash.mix());
-                    partitions[b].push_back(hash);
-                }
+            for (uint64_t i = 0; i != num_keys; ++i, ++it) {
+                auto const& key = *it;
+                auto hash = hash_key<hasher_type>(key, m_seed);
+                auto b = m_bucketer.bucket(hash.mix());
+                partitions[b].push_back(hash);
             }
+        }
 
-            if (config.dense_partitioning) {
-                // if (config.verbose) std::cout << "alpha value ignored for --dense" << std::endl;
-                m_table_size = constants::table_size_per_partition * num_partitions;
-            } else {
-                uint64_t cumulative_size = 0;
-                for (uint64_t i = 0; i != num_partitions; ++i) {
-                    auto const& partition = partitions[i];
-                    uint64_t table_size = static_cast<double>(partition.size()) / config.alpha;
-                    m_table_size += table_size;
-                    m_offsets[i] = cumulative_size;
-                    if (config.dense_partitioning) {
-                        cumulative_size += table_size;
-                    } else {
-                        cumulative_size += config.minimal ? partition.size() : table_size;
-                    }
-                }
-                m_offsets[num_partitions] = cumulative_size;
+        if (config.dense_partitioning) {
+            m_table_size = constants::table_size_per_partition * num_partitions;
+            if (num_keys > m_table_size) throw std::runtime_error("too many keys for --dense");
+        } else {
+            uint64_t cumulative_size = 0;
+            for (uint64_t i = 0; i != num_partitions; ++i) {
+                auto const& partition = partitions[i];
+                uint64_t table_size = static_cast<double>(partition.size()) / config.alpha;
+                m_table_size += table_size;
+                m_offsets[i] = cumulative_size;
+                cumulative_size += config.minimal ? partition.size() : table_size;
             }
+            m_offsets[num_partitions] = cumulative_size;
+        }
 
-            uint64_t largest_partition_size = 0;
-            uint64_t smallest_partition_size = uint64_t(-1);
-            for (auto const& partition : partitions) {
-                if (partition.size() > largest_partition_size) {
-                    largest_partition_size = partition.size();
-                }
-                if (partition.size() < smallest_partition_size) {
-                    smallest_partition_size = partition.size();
-                }
+        uint64_t largest_partition_size = 0;
+        uint64_t smallest_partition_size = uint64_t(-1);
+        for (auto const& partition : partitions) {
+            if (partition.size() > largest_partition_size) {
+                largest_partition_size = partition.size();
             }
-            if (config.verbose) {
-                std::cout << "smallest_partition_size = " << smallest_partition_size << std::endl;
-                std::cout << "largest_partition_size = " << largest_partition_size << std::endl;
-                std::cout << "num_buckets_per_partition = " << partition_config.num_buckets
-                          << std::endl;
+            if (partition.size() < smallest_partition_size) {
+                smallest_partition_size = partition.size();
             }
-
-            if (largest_partition_size <= partition_config.table_size) {
-                if (config.verbose and config.dense_partitioning) {
-                    std::cout << "load factor of partitions: "
-                              << (smallest_partition_size * 1.0) / partition_config.table_size
-                              << " <= alpha <= "
-                              << (largest_partition_size * 1.0) / partition_config.table_size
+        }
+        if (config.verbose) {
+            std::cout << "smallest_partition_size = " << smallest_partition_size << std::endl;
+            std::cout << "largest_partition_size = " << largest_partition_size << std::endl;
+            std::cout << "num_buckets_per_partition = " << partition_config.num_buckets
+                      << std::endl;
+            if (config.dense_partitioning) {
+                std::cout << "load factor of partitions: "
+                          << (smallest_partition_size * 1.0) / partition_config.table_size
+                          << " <= alpha <= "
+                          << (largest_partition_size * 1.0) / partition_config.table_size
+                          << std::endl;
+                /*
+                    Instead of re-hashing all keys with another seed, the keys exceeding
+                    table_size_per_partition are bumped to the fallback function.
+                */
+                if (largest_partition_size > partition_config.table_size) {
+                    std::cout << "overflowing partitions: their smallest buckets are bumped"
                               << std::endl;
                 }
-                break;
-            } else {
-                if (config.verbose) {
-                    std::cout << "attempt " << attempt + 1 << " with seed " << m_seed
-                              << " failed, trying another seed..." << std::endl;
-                    if (attempt + 1 == max_num_attempts) throw seed_runtime_error();
-                }
-
-                for (auto& partition : partitions) partition.clear();
             }
         }
 
@@ -143,8 +128,22 @@ struct internal_memory_builder_partitioned_phf {
 
         timings.partitioning_microseconds = to_microseconds(clock_type::now() - start);
 
-        auto t = build_partitions(partitions.begin(), m_builders.begin(), partition_config,
-                                  config.num_threads, num_partitions);
+        build_timings t;
+        try {
+            t = build_partitions(partitions.begin(), m_builders.begin(), partition_config,
+                                 config.num_threads, num_partitions);
+        } catch (seed_runtime_error const&) {
+            /* a partition failing with all its seeds is likely to contain duplicate keys */
+            if constexpr (CheckDuplicates and is_random_access_iterator<Iterator>) {
+                auto positions = check_duplicate_keys<hasher_type>(keys, num_keys, config);
+                if (!positions.empty()) {
+                    typedef subset_iterator<Iterator> subset_type;
+                    return build_from_keys<subset_type, false>(subset_type(keys, positions),
+                                                               positions.size(), config);
+                }
+            }
+            throw;
+        }
         timings.mapping_ordering_microseconds = t.mapping_ordering_microseconds;
         timings.searching_microseconds = t.searching_microseconds;
 
@@ -153,26 +152,85 @@ struct internal_memory_builder_partitioned_phf {
         //     std::cout << compute_empirical_entropy(b.pilots()) << std::endl;
         // }
 
-        if (config.minimal) {
+        std::vector<uint64_t> bumped;
+        if (config.dense_partitioning) {
+            for (auto const& b : m_builders) {
+                bumped.insert(bumped.end(), b.bumped().begin(), b.bumped().end());
+            }
+        }
+
+        if (!bumped.empty()) {
+            /*
+                Bumped keys are assigned to free slots of any partition, hence
+                we need a global bitmap to build the fallback function.
+            */
             auto start = clock_type::now();
-            m_free_slots.clear();
-            taken t(m_builders);
-            assert(t.size() >= num_keys);
-            m_free_slots.reserve(t.size() - num_keys);
-            fill_free_slots(t, num_keys, m_free_slots, m_table_size);
+            if (config.verbose) {
+                std::cout << bumped.size() << " keys bumped to the fallback function" << std::endl;
+            }
+            /*
+                The pilot marking bumped buckets may be unbounded (e.g., for buckets bumped
+                because their partition overflows): use the smallest value not used
+                as a pilot, so as not to affect the encoding of the pilots.
+            */
+            uint64_t bumped_pilot = 0;
+            for (auto const& b : m_builders) {
+                for (uint64_t pilot : b.pilots()) {
+                    if (pilot != b.fallback().bumped_pilot() and pilot >= bumped_pilot) {
+                        bumped_pilot = pilot + 1;
+                    }
+                }
+            }
+            for (auto& b : m_builders) b.set_bumped_pilot(bumped_pilot);
+            auto fallback_config = config;
+            fallback_config.max_num_pilot_trials = bumped_pilot;
+
+            bits::bit_vector::builder taken_bvb(m_table_size);
+            for (uint64_t i = 0, offset = 0; i != num_partitions; ++i) {
+                auto const& t = m_builders[i].taken();
+                for (uint64_t p = 0; p != t.num_bits(); ++p) {
+                    if (t.get(p)) taken_bvb.set(offset + p, true);
+                }
+                offset += t.num_bits();
+            }
+            m_fallback.build(bumped, taken_bvb, fallback_config);
+            if (config.minimal) {
+                bits::bit_vector t;
+                taken_bvb.build(t);
+                m_free_slots.clear();
+                m_free_slots.reserve(t.num_bits() - num_keys);
+                fill_free_slots(t, num_keys, m_free_slots, m_table_size);
+            }
             auto stop = clock_type::now();
             timings.searching_microseconds += to_microseconds(stop - start);
+        } else {
+            m_fallback.reset(config);
+            if (config.minimal) {
+                auto start = clock_type::now();
+                m_free_slots.clear();
+                taken t(m_builders);
+                assert(t.size() >= num_keys);
+                m_free_slots.reserve(t.size() - num_keys);
+                fill_free_slots(t, num_keys, m_free_slots, m_table_size);
+                auto stop = clock_type::now();
+                timings.searching_microseconds += to_microseconds(stop - start);
+            }
         }
 
         return timings;
     }
 
-    template <typename RandomAccessIterator>
+    /*
+        Keys read through a forward iterator are hashed in a pipeline (see pipelined_hash),
+        the others by num_threads ranges of keys.
+    */
+    template <typename Iterator>
     static void parallel_hash_and_partition(
-        RandomAccessIterator keys,
+        Iterator keys,
         std::vector<std::vector<typename hasher_type::hash_type>>& partitions,
         const uint64_t num_keys, const uint64_t num_threads, const uint64_t m_seed,
-        const uint64_t num_partitions, const range_bucketer partitioner)  //
+        const uint64_t num_partitions, const range_bucketer partitioner,
+        thread_pool& pool)  //
     {
         std::vector<std::vector<std::vector<typename hasher_type::hash_type>>> split;
         split.resize(num_threads);
@@ -184,13 +242,10 @@ struct internal_memory_builder_partitioned_phf {
             for (auto& c : v) c.reserve(cell_reserve);
         }
 
-        auto hash_and_split = [&](uint64_t id, uint64_t begin, uint64_t end) {
-            for (; begin != end; ++begin) {
-                typename hasher_type::hash_type hash = hasher_type::hash(keys[begin], m_seed);
-                uint64_t partition = partitioner.bucket(hash.mix());
-                uint64_t coloumn = partition / partitions_per_thread;
-                split[id][coloumn].push_back(hash);
-            }
+        auto split_hash = [&](uint64_t id, typename hasher_type::hash_type hash) {
+            uint64_t partition = partitioner.bucket(hash.mix());
+            uint64_t coloumn = partition / partitions_per_thread;
+            split[id][coloumn].push_back(hash);
         };
 
         auto merge_and_collect = [&](uint64_t id) {
@@ -202,24 +257,54 @@ struct internal_memory_builder_partitioned_phf {
             }
         };
 
-        std::vector<std::thread> threads(num_threads);
-        const uint64_t num_keys_per_thread = (num_keys + num_threads - 1) / num_threads;
-        for (uint64_t i = 0, begin = 0; i != num_threads; ++i) {
-            uint64_t end = begin + num_keys_per_thread;
-            if (end > num_keys) end = num_keys;
-            threads[i] = std::thread(hash_and_split, i, begin, end);
-            begin = end;
-        }
-        for (auto& t : threads) {
-            if (t.joinable()) t.join();
+        if constexpr (is_random_access_iterator<Iterator>) {
+            const uint64_t num_keys_per_thread = (num_keys + num_threads - 1) / num_threads;
+            pool.run(num_threads, [&](uint64_t i) {
+                uint64_t begin = std::min(i * num_keys_per_thread, num_keys);
+                const uint64_t end = std::min(begin + num_keys_per_thread, num_keys);
+                for (; begin != end; ++begin) {
+                    split_hash(i, hash_key<hasher_type>(keys[begin], m_seed));
+                }
+            });
+        } else {
+            pipelined_hash<hasher_type>(keys, num_keys, m_seed, num_threads, pool,
+                                        [&](uint64_t id, uint64_t /* i */, auto hash) {
+                                            split_hash(id, hash);
+                                        });
         }
+        pool.run(num_threads, merge_and_collect);
+    }
 
-        for (uint64_t i = 0; i != num_threads; ++i) {
-            threads[i] = std::thread(merge_and_collect, i);
-        }
-        for (auto& t : threads) {
-            if (t.joinable()) t.join();
+    /*
+        Build a partition from hash codes computed with config.seed. If the build fails
+        (e.g., two keys collide in a bucket), only this partition is built again,
+        re-hashing its hash codes with the partition seed config.seed + attempt.
+        Queries recognize such partitions because their seed differs from the global one.
+    */
+    template <typename HashRandomAccessIterator, typename Builder>
+    static build_timings build_partition(HashRandomAccessIterator hashes, const uint64_t num_keys,
+                                         Builder& builder, build_configuration const& config)  //
+    {
+        auto partition_config = config;
+        const uint64_t max_num_attempts = 10;
+        for (uint64_t attempt = 0; attempt != max_num_attempts; ++attempt) {
+            partition_config.seed = config.seed + attempt;
+            builder.set_seed(partition_config.seed);
+            try {
+                if (attempt == 0) {
+                    return builder.build_from_hashes(hashes, num_keys, partition_config);
+                }
+                return builder.build_from_hashes(
+                    rehash_generator<HashRandomAccessIterator>(hashes, partition_config.seed),
+                    num_keys, partition_config);
+            } catch (seed_runtime_error const&) {
+                if (config.verbose) {
+                    std::cout << "partition seed " << partition_config.seed << " failed"
+                              << std::endl;
+                }
+            }
         }
+        throw seed_runtime_error();
     }
 
     template <typename PartitionsIterator, typename BuildersIterator>
@@ -231,33 +316,24 @@ struct internal_memory_builder_partitioned_phf {
         assert(config.num_threads == 1);
 
         if (num_threads > 1) {  // parallel
-            std::vector<std::thread> threads(num_threads);
             std::vector<build_timings> thread_timings(num_threads);
 
-            auto exe = [&](uint64_t i, uint64_t begin, uint64_t end) {
-                for (; begin != end; ++begin) {
-                    auto const& partition = partitions[begin];
-                    builders[begin].set_seed(config.seed);
-                    auto t = builders[begin].build_from_hashes(partition.begin(), partition.size(),
-                                                               config);
-                    thread_timings[i].mapping_ordering_microseconds +=
-                        t.mapping_ordering_microseconds;
-                    thread_timings[i].searching_microseconds += t.searching_microseconds;
-                }
-            };
-
-            const uint64_t num_partitions_per_thread =
-                (num_partitions + num_threads - 1) / num_threads;
-            for (uint64_t i = 0, begin = 0; i != num_threads; ++i) {
-                uint64_t end = begin + num_partitions_per_thread;
-                if (end > num_partitions) end = num_partitions;
-                threads[i] = std::thread(exe, i, begin, end);
-                begin = end;
-            }
+            /* largest partitions first, so that the last ones to be built are the smallest */
+            std::vector<uint64_t> order(num_partitions);
+            std::iota(order.begin(), order.end(), 0);
+            std::stable_sort(order.begin(), order.end(), [&](uint64_t i, uint64_t j) {
+                return partitions[i].size() > partitions[j].size();
+            });
 
-            for (auto& t : threads) {
-                if (t.joinable()) t.join();
-            }
+            auto exe = [&](uint64_t thread, uint64_t k) {
+                const uint64_t i = order[k];
+                auto const& partition = partitions[i];
+                auto t = build_partition(partition.begin(), partition.size(), builders[i], config);
+                thread_timings[thread].mapping_ordering_microseconds +=
+                    t.mapping_ordering_microseconds;
+                thread_timings[thread].searching_microseconds += t.searching_microseconds;
+            };
+            get_thread_pool(config.pool).parallel_for(num_threads, num_partitions, exe);
 
             for (auto const& t : thread_timings) {
                 if (t.mapping_ordering_microseconds > timings.mapping_ordering_microseconds)
@@ -268,8 +344,7 @@ struct internal_memory_builder_partitioned_phf {
         } else {  // sequential
             for (uint64_t i = 0; i != num_partitions; ++i) {
                 auto const& partition = partitions[i];
-                builders[i].set_seed(config.seed);
-                auto t = builders[i].build_from_hashes(partition.begin(), partition.size(), config);
+                auto t = build_partition(partition.begin(), partition.size(), builders[i], config);
                 timings.mapping_ordering_microseconds += t.mapping_ordering_microseconds;
                 timings.searching_microseconds += t.searching_microseconds;
             }
@@ -306,6 +381,16 @@ struct internal_memory_builder_partitioned_phf {
         return m_bucketer;
     }
 
+    /* The bucketer used within the partitions (the same for all partitions when dense). */
+    bucketer_type partition_bucketer() const {
+        return m_builders.front().bucketer();
+    }
+
+    uint64_t partition_seed(const uint64_t partition) const {
+        assert(partition < m_num_partitions);
+        return m_builders[partition].seed();
+    }
+
     std::vector<uint64_t> const& offsets() const {
         return m_offsets;
     }
@@ -319,6 +404,10 @@ struct internal_memory_builder_partitioned_phf {
         return m_builders;
     }
 
+    fallback_builder const& fallback() const {
+        return m_fallback;
+    }
+
     struct interleaving_pilots_iterator  //
     {
         /* Must define all the five properties, otherwise compilation fails. */
@@ -456,6 +545,7 @@ private:
     std::vector<uint64_t> m_offsets;
     std::vector<uint64_t> m_free_slots;  // for dense partitioning
     std::vector<internal_memory_builder_single_phf<hasher_type, bucketer_type>> m_builders;
+    fallback_builder m_fallback;  // for dense partitioning
 };
 
 }  // namespace pthash
\ No newline at end of file
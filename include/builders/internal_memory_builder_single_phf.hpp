@@ -2,6 +2,7 @@
 
 #include "builders/util.hpp"
 #include "builders/search.hpp"
+#include "builders/fallback_builder.hpp"
 #include "utils/bucketers.hpp"
 #include "utils/logger.hpp"
 #include "utils/hasher.hpp"
@@ -15,6 +16,7 @@ struct internal_memory_builder_single_phf {
 
     internal_memory_builder_single_phf()
         : m_seed(constants::invalid_seed)
+        , m_salt(constants::invalid_seed)
         , m_num_keys(0)
         , m_num_buckets(0)
         , m_table_size(0)
@@ -22,26 +24,63 @@ struct internal_memory_builder_single_phf {
         , m_pilots()
         , m_free_slots() {}
 
-    template <typename RandomAccessIterator>
+    template <typename RandomAccessIterator, bool CheckDuplicates = true>
     build_timings build_from_keys(RandomAccessIterator keys, const uint64_t num_keys,
                                   build_configuration const& config)  //
     {
-        if (config.seed == constants::invalid_seed) {
-            build_configuration actual_config = config;
-            for (auto attempt = 0; attempt < 10; ++attempt) {
-                actual_config.seed = random_value();
-                try {
-                    return build_from_hashes(
-                        hash_generator<RandomAccessIterator>(keys, actual_config.seed), num_keys,
-                        actual_config);
-                } catch (seed_runtime_error const& error) {
-                    std::cout << "attempt " << attempt + 1 << " failed" << std::endl;
+        build_configuration actual_config = config;
+        const bool random_seed = config.seed == constants::invalid_seed;
+        if (random_seed) actual_config.seed = random_value();
+        std::vector<typename hasher_type::hash_type> hashes;
+        try {
+            if constexpr (!is_random_access_iterator<RandomAccessIterator>) {
+                /* map_parallel needs random access: hash the keys beforehand, in parallel */
+                if (config.num_threads > 1 and num_keys >= config.num_threads) {
+                    hashes.resize(num_keys);
+                    compute_hashes(keys, num_keys, actual_config, hashes);
+                    return build_from_hashes(hashes.data(), num_keys, actual_config);
+                }
+            }
+            return build_from_hashes(hash_generator<RandomAccessIterator>(keys, actual_config.seed),
+                                     num_keys, actual_config);
+        } catch (seed_runtime_error const& error) {
+            if constexpr (CheckDuplicates and is_random_access_iterator<RandomAccessIterator>) {
+                /*
+                    Duplicate keys make every seed fail: look for them
+                    before trying another seed.
+                */
+                auto positions = check_duplicate_keys<hasher_type>(keys, num_keys, actual_config);
+                if (!positions.empty()) {
+                    typedef subset_iterator<RandomAccessIterator> subset_type;
+                    return build_from_keys<subset_type, false>(subset_type(keys, positions),
+                                                               positions.size(), config);
                 }
             }
-            throw seed_runtime_error();
+            if (!random_seed) throw;
+            std::cout << "attempt 1 failed" << std::endl;
+        }
+
+        /*
+            Rather than hashing the keys again with another seed, keep their hash codes
+            and re-hash them with a different salt at each attempt.
+        */
+        if (hashes.empty()) {
+            hashes.resize(num_keys);
+            compute_hashes(keys, num_keys, actual_config, hashes);
         }
-        return build_from_hashes(hash_generator<RandomAccessIterator>(keys, config.seed), num_keys,
-                                 config);
+        for (auto attempt = 1; attempt < 10; ++attempt) {
+            const uint64_t salt = random_value();
+            try {
+                auto timings = build_from_hashes(
+                    rehash_generator<typename hasher_type::hash_type const*>(hashes.data(), salt),
+                    num_keys, actual_config);
+                m_salt = salt;
+                return timings;
+            } catch (seed_runtime_error const& error) {
+                std::cout << "attempt " << attempt + 1 << " failed" << std::endl;
+            }
+        }
+        throw seed_runtime_error();
     }
 
     template <typename RandomAccessIterator>
@@ -63,13 +102,15 @@ struct internal_memory_builder_single_phf {
 
         uint64_t table_size = static_cast<double>(num_keys) / config.alpha;
         if (config.table_size != constants::invalid_table_size) table_size = config.table_size;
-        assert(table_size >= num_keys);
+        /* with dense partitioning, a partition can overflow its table */
+        assert(table_size >= num_keys or config.dense_partitioning);
 
         const uint64_t num_buckets = (config.num_buckets == constants::invalid_num_buckets)
                                          ? compute_num_buckets(num_keys, config.lambda)
                                          : config.num_buckets;
 
         m_seed = config.seed;
+        m_salt = constants::invalid_seed;
         m_num_keys = num_keys;
         m_table_size = table_size;
         m_num_buckets = num_buckets;
@@ -103,7 +144,6 @@ struct internal_memory_builder_single_phf {
             }
         }
 
-        auto buckets_iterator = buckets.begin();
         time.mapping_ordering_microseconds = to_microseconds(clock_type::now() - start);
         if (config.verbose) {
             std::cout << " == mapping+ordering took "
@@ -116,12 +156,32 @@ struct internal_memory_builder_single_phf {
             m_pilots.resize(num_buckets);
             std::fill(m_pilots.begin(), m_pilots.end(), 0);
             bits::bit_vector::builder taken_bvb(m_table_size);
-            uint64_t num_non_empty_buckets = buckets.num_buckets();
             pilots_wrapper_t pilots_wrapper(m_pilots);
+            std::vector<uint64_t> bumped;
+            if (m_num_keys > m_table_size) {
+                /* bump the smallest buckets, so that the remaining keys fit in the table */
+                buckets.bump_smallest(m_num_keys - m_table_size, config.max_num_pilot_trials,
+                                      pilots_wrapper, bumped);
+            }
+            uint64_t num_non_empty_buckets = buckets.num_buckets();
+            auto buckets_iterator = buckets.begin();
             search(m_num_keys, m_num_buckets, num_non_empty_buckets,  //
-                   config, buckets_iterator, taken_bvb, pilots_wrapper);
+                   config, buckets_iterator, taken_bvb, pilots_wrapper, bumped);
+            if (config.verbose and !bumped.empty()) {
+                std::cout << " == " << bumped.size() << " keys bumped to the fallback function"
+                          << std::endl;
+            }
+            if (config.dense_partitioning) {
+                /* the fallback is global for dense partitioning: see
+                   internal_memory_builder_partitioned_phf */
+                m_bumped.swap(bumped);
+                m_fallback.reset(config);
+            } else {
+                m_fallback.build(bumped, taken_bvb, config);
+            }
             taken_bvb.build(m_taken);
-            if (config.minimal) {
+            /* for dense partitioning, free slots are computed globally */
+            if (config.minimal and !config.dense_partitioning) {
                 m_free_slots.clear();
                 assert(m_taken.num_bits() >= num_keys);
                 m_free_slots.reserve(m_taken.num_bits() - num_keys);
@@ -145,6 +205,11 @@ struct internal_memory_builder_single_phf {
         return m_seed;
     }
 
+    /* If not constants::invalid_seed, the hash codes are re-hashed with this salt. */
+    uint64_t salt() const {
+        return m_salt;
+    }
+
     uint64_t num_keys() const {
         return m_num_keys;
     }
@@ -177,14 +242,34 @@ struct internal_memory_builder_single_phf {
         return m_free_slots;
     }
 
+    fallback_builder const& fallback() const {
+        return m_fallback;
+    }
+
+    /* Relabel the pilot of the bumped buckets. */
+    void set_bumped_pilot(const uint64_t pilot) {
+        for (auto& p : m_pilots) {
+            if (p == m_fallback.bumped_pilot()) p = pilot;
+        }
+        m_fallback.set_bumped_pilot(pilot);
+    }
+
+    /* Payloads of the bumped keys that are not handled by fallback(). */
+    std::vector<uint64_t> const& bumped() const {
+        return m_bumped;
+    }
+
     void swap(internal_memory_builder_single_phf& other) {
         std::swap(m_seed, other.m_seed);
+        std::swap(m_salt, other.m_salt);
         std::swap(m_num_keys, other.m_num_keys);
         std::swap(m_num_buckets, other.m_num_buckets);
         std::swap(m_table_size, other.m_table_size);
         m_bucketer.swap(other.m_bucketer);
         m_pilots.swap(other.m_pilots);
         m_free_slots.swap(other.m_free_slots);
+        m_fallback.swap(other.m_fallback);
+        m_bumped.swap(other.m_bumped);
     }
 
     template <typename Visitor>
@@ -221,15 +306,18 @@ private:
     template <typename Visitor, typename T>
     static void visit_impl(Visitor& visitor, T&& t) {
         visitor.visit(t.m_seed);
+        visitor.visit(t.m_salt);
         visitor.visit(t.m_num_keys);
         visitor.visit(t.m_num_buckets);
         visitor.visit(t.m_table_size);
         visitor.visit(t.m_bucketer);
         visitor.visit(t.m_pilots);
         visitor.visit(t.m_free_slots);
+        visitor.visit(t.m_fallback);
     }
 
     uint64_t m_seed;
+    uint64_t m_salt;
     uint64_t m_num_keys;
     uint64_t m_num_buckets;
     uint64_t m_table_size;
@@ -239,13 +327,15 @@ private:
     bits::bit_vector m_taken;
     std::vector<uint64_t> m_pilots;
     std::vector<uint64_t> m_free_slots;
+    fallback_builder m_fallback;
+    std::vector<uint64_t> m_bumped;
 
     template <typename RandomAccessIterator>
     struct hash_generator {
         hash_generator(RandomAccessIterator keys, uint64_t seed) : m_iterator(keys), m_seed(seed) {}
 
         inline auto operator*() {
-            return hasher_type::hash(*m_iterator, m_seed);
+            return hash_key<hasher_type>(*m_iterator, m_seed);
         }
 
         inline void operator++() {
@@ -261,6 +351,38 @@ private:
         uint64_t m_seed;
     };
 
+    template <typename Iterator>
+    static void compute_hashes(Iterator keys, const uint64_t num_keys,
+                               build_configuration const& config,
+                               std::vector<typename hasher_type::hash_type>& hashes)  //
+    {
+        if constexpr (is_random_access_iterator<Iterator>) {
+            if (config.num_threads > 1 and num_keys >= config.num_threads) {
+                const uint64_t num_keys_per_thread =
+                    (num_keys + config.num_threads - 1) / config.num_threads;
+                auto exe = [&](uint64_t begin, const uint64_t end) {
+                    for (; begin != end; ++begin) {
+                        hashes[begin] = hash_key<hasher_type>(keys[begin], config.seed);
+                    }
+                };
+                get_thread_pool(config.pool).run(config.num_threads, [&](uint64_t i) {
+                    const uint64_t begin = std::min(i * num_keys_per_thread, num_keys);
+                    exe(begin, std::min(begin + num_keys_per_thread, num_keys));
+                });
+                return;
+            }
+        } else {
+            if (config.num_threads > 1 and num_keys >= config.num_threads) {
+                pipelined_hash<hasher_type>(
+                    keys, num_keys, config.seed, config.num_threads, get_thread_pool(config.pool),
+                    [&](uint64_t /* thread */, uint64_t i, auto hash) { hashes[i] = hash; });
+                return;
+            }
+        }
+        hash_generator<Iterator> it(keys, config.seed);
+        for (uint64_t i = 0; i != num_keys; ++i, ++it) hashes[i] = *it;
+    }
+
     typedef std::vector<bucket_payload_pair> pairs_t;
 
     struct buckets_iterator_t {
@@ -320,6 +442,28 @@ private:
             return buckets_iterator_t(m_buffers);
         }
 
+        /*
+            Remove the smallest buckets until at least num_keys keys are removed,
+            assigning them the given pilot and appending their payloads to 'bumped'.
+        */
+        template <typename PilotsBuffer>
+        void bump_smallest(uint64_t num_keys, const uint64_t pilot, PilotsBuffer& pilots,
+                           std::vector<uint64_t>& bumped) {
+            for (uint64_t i = 0; i != MAX_BUCKET_SIZE and num_keys > 0; ++i) {
+                auto& buffer = m_buffers[i];
+                const uint64_t bucket_size = i + 1;
+                while (!buffer.empty() and num_keys > 0) {
+                    bucket_t bucket;
+                    bucket.init(buffer.data() + buffer.size() - (bucket_size + 1), i + 1);
+                    pilots.emplace_back(bucket.id(), pilot);
+                    bumped.insert(bumped.end(), bucket.begin(), bucket.end());
+                    buffer.resize(buffer.size() - (bucket_size + 1));
+                    num_keys -= std::min(num_keys, bucket_size);
+                    --m_num_buckets;
+                }
+            }
+        }
+
         void print_bucket_size_distribution() {
             uint64_t max_bucket_size = (*(begin())).size();
             std::cout << " == max bucket size = " << max_bucket_size << std::endl;
@@ -383,11 +527,7 @@ private:
             std::sort(local_pairs.begin(), local_pairs.end());
         };
 
-        std::vector<std::thread> threads(config.num_threads);
-        for (uint64_t i = 0; i != config.num_threads; ++i) threads[i] = std::thread(exe, i);
-        for (auto& t : threads) {
-            if (t.joinable()) t.join();
-        }
+        get_thread_pool(config.pool).run(config.num_threads, exe);
     }
 
     template <typename RandomAccessIterator>
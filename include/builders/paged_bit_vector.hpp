@@ -0,0 +1,92 @@
+#pragma once
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <cassert>
+#include <cstdint>
+#include <cstdio>
+#include <stdexcept>
+#include <string>
+
+namespace pthash {
+
+/*
+    A bit vector of fixed size stored in a temporary file and memory-mapped in shared mode:
+    its pages live in the page cache, that the kernel writes back and reclaims under memory
+    pressure, instead of in the memory of the process. Used in place of
+    bits::bit_vector::builder for the bitmap of taken slots when this does not fit in the
+    RAM budget of an external construction (same get/set/num_bits/get_iterator_at interface).
+    The file is removed on destruction.
+*/
+struct paged_bit_vector {
+    paged_bit_vector(std::string const& filename, const uint64_t num_bits)
+        : m_filename(filename), m_num_bits(num_bits), m_bytes(8 * ((num_bits + 63) / 64)) {
+        int fd = ::open(filename.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0600);
+        if (fd == -1) throw std::runtime_error("cannot open file '" + filename + "'");
+        /* a sparse file: the pages are zero until written */
+        if (::ftruncate(fd, m_bytes) != 0) {
+            ::close(fd);
+            std::remove(filename.c_str());
+            throw std::runtime_error("cannot resize file '" + filename + "'");
+        }
+        void* data = ::mmap(nullptr, m_bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (data == MAP_FAILED) {
+            std::remove(filename.c_str());
+            throw std::runtime_error("cannot map file '" + filename + "'");
+        }
+        m_data = static_cast<uint64_t*>(data);
+        /* slots are probed at random positions: read-ahead would only waste I/O */
+        ::madvise(data, m_bytes, MADV_RANDOM);
+    }
+
+    paged_bit_vector(paged_bit_vector const&) = delete;
+    paged_bit_vector& operator=(paged_bit_vector const&) = delete;
+
+    ~paged_bit_vector() {
+        ::munmap(m_data, m_bytes);
+        std::remove(m_filename.c_str());
+    }
+
+    uint64_t num_bits() const { return m_num_bits; }
+
+    inline bool get(uint64_t i) const {
+        assert(i < m_num_bits);
+        return (m_data[i >> 6] >> (i & 63)) & 1;
+    }
+
+    inline void set(uint64_t i, bool b = true) {
+        assert(i < m_num_bits);
+        const uint64_t mask = uint64_t(1) << (i & 63);
+        if (b) {
+            m_data[i >> 6] |= mask;
+        } else {
+            m_data[i >> 6] &= ~mask;
+        }
+    }
+
+    /* The bitmap is scanned left to right from now on (e.g., to fill the free slots). */
+    void advise_sequential() const { ::madvise(m_data, m_bytes, MADV_SEQUENTIAL); }
+
+    struct iterator {
+        iterator(uint64_t const* data, uint64_t pos) : m_data(data), m_pos(pos) {}
+        bool operator*() const { return (m_data[m_pos >> 6] >> (m_pos & 63)) & 1; }
+        void operator++() { ++m_pos; }
+
+    private:
+        uint64_t const* m_data;
+        uint64_t m_pos;
+    };
+
+    iterator get_iterator_at(uint64_t pos) const { return iterator(m_data, pos); }
+
+private:
+    std::string m_filename;
+    uint64_t m_num_bits;
+    uint64_t m_bytes;
+    uint64_t* m_data;
+};
+
+}  // namespace pthash
\ No newline at end of file
@@ -11,17 +11,29 @@
 
 namespace pthash {
 
-template <typename BucketsIterator, typename PilotsBuffer>
+/*
+    Buckets for which no pilot in [0, config.max_num_pilot_trials) works are "bumped":
+    they get the reserved pilot config.max_num_pilot_trials and their payloads are
+    appended to 'bumped', to be handled by a fallback function (see fallback_builder).
+*/
+template <typename Bucket>
+static inline void bump(Bucket const& bucket, std::vector<uint64_t>& bumped) {
+    bumped.insert(bumped.end(), bucket.begin(), bucket.end());
+}
+
+template <typename BucketsIterator, typename Taken, typename PilotsBuffer>
 void search_sequential(const uint64_t num_keys,               //
                        const uint64_t num_buckets,            //
                        const uint64_t num_non_empty_buckets,  //
                        build_configuration const& config,     //
                        BucketsIterator& buckets,              //
-                       bits::bit_vector::builder& taken,      //
-                       PilotsBuffer& pilots)                  //
+                       Taken& taken,                          //
+                       PilotsBuffer& pilots,                  //
+                       std::vector<uint64_t>& bumped)         //
 {
     const uint64_t max_bucket_size = (*buckets).size();
     const uint64_t table_size = taken.num_bits();
+    const uint64_t max_num_pilot_trials = config.max_num_pilot_trials;
 
     std::vector<uint64_t> positions;
     positions.reserve(max_bucket_size);
@@ -35,6 +47,13 @@ void search_sequential(const uint64_t num_keys,               //
         assert(bucket.size() > 0);
 
         for (uint64_t pilot = 0; true; ++pilot) {
+            if (pilot == max_num_pilot_trials) {
+                pilots.emplace_back(bucket.id(), pilot);
+                bump(bucket, bumped);
+                if (config.verbose) log.update(processed_buckets, 0);
+                break;
+            }
+
             uint64_t hashed_pilot =
                 PTHASH_LIKELY(pilot < search_cache_size) ? hashed_pilots_cache[pilot] : mix(pilot);
 
@@ -70,18 +89,20 @@ void search_sequential(const uint64_t num_keys,               //
     if (config.verbose) log.finalize(processed_buckets);
 }
 
-template <typename BucketsIterator, typename PilotsBuffer>
+template <typename BucketsIterator, typename Taken, typename PilotsBuffer>
 void search_parallel(const uint64_t num_keys,               //
                      const uint64_t num_buckets,            //
                      const uint64_t num_non_empty_buckets,  //
                      build_configuration const& config,     //
                      BucketsIterator& buckets,              //
-                     bits::bit_vector::builder& taken,      //
-                     PilotsBuffer& pilots)                  //
+                     Taken& taken,                          //
+                     PilotsBuffer& pilots,                  //
+                     std::vector<uint64_t>& bumped)         //
 {
     const uint64_t max_bucket_size = (*buckets).size();
     const uint64_t table_size = taken.num_bits();
     const uint64_t num_threads = config.num_threads;
+    const uint64_t max_num_pilot_trials = config.max_num_pilot_trials;
 
     search_logger log(num_keys, num_buckets);
     if (config.verbose) log.init();
@@ -101,6 +122,13 @@ void search_parallel(const uint64_t num_keys,               //
                 uint64_t local_next_bucket_idx = next_bucket_idx;
 
                 for (; true; ++pilot) {
+                    /*
+                        Bits in the bitmap are only ever set, so a bucket that exhausted
+                        its pilot trials against the current bitmap would do the same
+                        against the final one: it can be bumped without re-checking.
+                    */
+                    if (pilot == max_num_pilot_trials) break;
+
                     if (PTHASH_LIKELY(!pilot_checked)) {
                         uint64_t hashed_pilot = PTHASH_LIKELY(pilot < search_cache_size)
                                                     ? hashed_pilots_cache[pilot]
@@ -142,6 +170,12 @@ void search_parallel(const uint64_t num_keys,               //
                 // I am the first thread: this is the only condition that can stop the loop
                 if (local_next_bucket_idx == local_bucket_idx) break;
 
+                if (pilot == max_num_pilot_trials) {  // wait for my turn to bump the bucket
+                    while (local_bucket_idx != next_bucket_idx)
+                        ;
+                    break;
+                }
+
                 // active wait until another thread pushes a change in the bitmap
                 while (local_next_bucket_idx == next_bucket_idx)
                     ;
@@ -151,11 +185,16 @@ void search_parallel(const uint64_t num_keys,               //
             /* thread-safe from now on */
 
             pilots.emplace_back(bucket.id(), pilot);
-            for (auto p : positions) {
-                assert(taken.get(p) == false);
-                taken.set(p, true);
+            if (PTHASH_LIKELY(pilot != max_num_pilot_trials)) {
+                for (auto p : positions) {
+                    assert(taken.get(p) == false);
+                    taken.set(p, true);
+                }
+                if (config.verbose) log.update(local_bucket_idx, bucket.size());
+            } else {
+                bump(bucket, bumped);
+                if (config.verbose) log.update(local_bucket_idx, 0);
             }
-            if (config.verbose) log.update(local_bucket_idx, bucket.size());
 
             // update (local) local_bucket_idx
             local_bucket_idx = next_bucket_idx + num_threads;
@@ -175,31 +214,30 @@ void search_parallel(const uint64_t num_keys,               //
         }
     };
 
-    std::vector<std::thread> threads;
-    threads.reserve(num_threads);
-    next_bucket_idx = static_cast<uint64_t>(-1);  // avoid that some thread advances the iterator
+    /* the first bucket of every thread is read before any thread can advance the iterator */
+    std::vector<bucket_t> first_buckets;
+    first_buckets.reserve(num_threads);
     for (uint64_t i = 0; i != num_threads and i < num_non_empty_buckets; ++i, ++buckets) {
-        bucket_t bucket = *buckets;
-        threads.emplace_back(exe, i, bucket);
+        first_buckets.push_back(*buckets);
     }
 
-    next_bucket_idx = 0;  // notify the first thread
-    for (auto& t : threads) {
-        if (t.joinable()) t.join();
-    }
+    next_bucket_idx = 0;
+    get_thread_pool(config.pool).run(first_buckets.size(),
+                                     [&](uint64_t i) { exe(i, first_buckets[i]); });
     assert(next_bucket_idx == num_non_empty_buckets);
 
     if (config.verbose) log.finalize(next_bucket_idx);
 }
 
-template <typename BucketsIterator, typename PilotsBuffer>
+template <typename BucketsIterator, typename Taken, typename PilotsBuffer>
 void search(const uint64_t num_keys,               //
             const uint64_t num_buckets,            //
             const uint64_t num_non_empty_buckets,  //
             build_configuration const& config,     //
             BucketsIterator& buckets,              //
-            bits::bit_vector::builder& taken,      //
-            PilotsBuffer& pilots)                  //
+            Taken& taken,                          //
+            PilotsBuffer& pilots,                  //
+            std::vector<uint64_t>& bumped)         //
 {
     if (config.num_threads > 1) {
         if (config.num_threads > std::thread::hardware_concurrency()) {
@@ -208,10 +246,10 @@ void search(const uint64_t num_keys,               //
                                         " threads");
         }
         search_parallel(num_keys, num_buckets, num_non_empty_buckets,  //
-                        config, buckets, taken, pilots);
+                        config, buckets, taken, pilots, bumped);
     } else {
         search_sequential(num_keys, num_buckets, num_non_empty_buckets,  //
-                          config, buckets, taken, pilots);
+                          config, buckets, taken, pilots, bumped);
     }
 }
 
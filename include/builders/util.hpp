@@ -3,8 +3,13 @@
 #include <fstream>
 #include <thread>
 #include <cmath>  // log, sqrt
+#include <functional>
+#include <cstring>   // memcpy
+#include <iterator>  // iterator_traits
+#include <limits>
 
 #include "utils/logger.hpp"
+#include "utils/thread_pool.hpp"
 #include "utils/util.hpp"
 
 namespace pthash {
@@ -44,12 +49,18 @@ struct build_configuration {
         , num_buckets(constants::invalid_num_buckets)
         , table_size(constants::invalid_table_size)
         , seed(constants::invalid_seed)
+        , max_num_pilot_trials(constants::unbounded_num_pilot_trials)
         , num_threads(1)
+        , pool(nullptr)
         , ram(static_cast<double>(constants::available_ram) * 0.75)
         , tmp_dir(constants::default_tmp_dirname)
+        , compress_tmp_files(false)
+        , bypass_page_cache(false)
+        , checkpoint(false)
         , dense_partitioning(false)
         , minimal(true)
-        , verbose(true) {}
+        , verbose(true)
+        , drop_duplicate_keys(false) {}
 
     double lambda;  // avg. bucket size
     double alpha;   // load factor
@@ -57,14 +68,43 @@ struct build_configuration {
     uint64_t num_buckets;
     uint64_t table_size;
     uint64_t seed;
+    uint64_t max_num_pilot_trials;  // buckets exceeding this are bumped to a fallback function
     uint64_t num_threads;
+    thread_pool* pool;  // runs the parallel sections, if not null (see default_thread_pool)
     uint64_t ram;
-    std::string tmp_dir;
+    std::string tmp_dir;  // one or more directories separated by ':' (see split_tmp_dirs)
+    bool compress_tmp_files;  // store the sorted runs of an external build compressed
+    bool bypass_page_cache;   // evict the temporary files of an external build from the cache
+    bool checkpoint;          // make an external partitioned build resumable after a failure
     bool dense_partitioning;
     bool minimal;
     bool verbose;
+
+    /*
+        Called with (i, j), i > j, for each input key such that keys[i] == keys[j].
+        Duplicate keys are dropped if drop_duplicate_keys is true;
+        otherwise, the build fails with duplicate_keys_error.
+    */
+    std::function<void(uint64_t, uint64_t)> duplicate_keys_callback;
+    bool drop_duplicate_keys;
 };
 
+/*
+    The temporary directory of an external build can list several directories separated
+    by ':', e.g., one per disk. Temporary files are spread round-robin across them.
+*/
+static inline std::vector<std::string> split_tmp_dirs(std::string const& tmp_dir) {
+    std::vector<std::string> dirs;
+    for (std::string::size_type begin = 0; begin <= tmp_dir.size();) {
+        std::string::size_type end = tmp_dir.find(':', begin);
+        if (end == std::string::npos) end = tmp_dir.size();
+        if (end != begin) dirs.push_back(tmp_dir.substr(begin, end - begin));
+        begin = end + 1;
+    }
+    if (dirs.empty()) dirs.push_back(constants::default_tmp_dirname);
+    return dirs;
+}
+
 static inline uint64_t compute_avg_partition_size(const uint64_t num_keys,
                                                   build_configuration const& config)  //
 {
@@ -133,6 +173,191 @@ struct seed_runtime_error : public std::runtime_error {
     seed_runtime_error() : std::runtime_error("seed did not work") {}
 };
 
+struct duplicate_keys_error : public std::runtime_error {
+    duplicate_keys_error() : std::runtime_error("input contains duplicate keys") {}
+};
+
+template <typename Iterator>
+constexpr bool is_random_access_iterator = std::is_base_of_v<
+    std::random_access_iterator_tag, typename std::iterator_traits<Iterator>::iterator_category>;
+
+/*
+    A key given by its hash code, computed beforehand with seed (see hash_collector).
+    Two prehashed keys are equal if their hash codes are.
+*/
+template <typename Hash>
+struct prehashed_key {
+    Hash hash;
+    uint64_t seed;
+
+    bool operator==(prehashed_key const& other) const {
+        return hash.first() == other.hash.first() and hash.second() == other.hash.second();
+    }
+};
+
+/* The builders hash the keys with hash_key: a prehashed key is not hashed again. */
+template <typename Hasher, typename Key>
+static inline typename Hasher::hash_type hash_key(Key const& key, const uint64_t seed) {
+    return Hasher::hash(key, seed);
+}
+
+template <typename Hasher, typename Hash>
+static inline Hash hash_key(prehashed_key<Hash> const& key, const uint64_t seed) {
+    static_assert(std::is_same_v<Hash, typename Hasher::hash_type>);
+    if (key.seed != seed) {
+        throw std::invalid_argument("keys hashed with seed " + std::to_string(key.seed) +
+                                    " but the build uses seed " + std::to_string(seed));
+    }
+    return key.hash;
+}
+
+/*
+    Pipelined hashing of keys that can only be read in order (e.g., lines of a file): while
+    the calling thread reads a block of keys, num_threads workers hash the previous block.
+    Worker id hashes a contiguous slice of each block and calls consume(id, i, hash) for
+    the i-th key of the input: a worker sees the keys in increasing order of i.
+*/
+template <typename Hasher, typename Iterator, typename Consumer>
+void pipelined_hash(Iterator keys, const uint64_t num_keys, const uint64_t seed,
+                    const uint64_t num_threads, thread_pool& pool, Consumer consume)  //
+{
+    typedef std::decay_t<decltype(*keys)> key_type;
+    const uint64_t block_size = std::min<uint64_t>(num_threads * (1ULL << 16), num_keys);
+
+    std::vector<key_type> blocks[2];
+    auto read_block = [&](std::vector<key_type>& block, const uint64_t size) {
+        block.clear();
+        block.reserve(size);
+        for (uint64_t i = 0; i != size; ++i, ++keys) block.push_back(*keys);
+    };
+
+    uint64_t num_read_keys = block_size;
+    read_block(blocks[0], num_read_keys);
+    for (uint64_t round = 0, first = 0; !blocks[round % 2].empty(); ++round) {
+        auto const& block = blocks[round % 2];
+        auto workers = pool.async(num_threads, [&, first](uint64_t id) {
+            const uint64_t slice_size = (block.size() + num_threads - 1) / num_threads;
+            const uint64_t end = std::min((id + 1) * slice_size, block.size());
+            for (uint64_t i = id * slice_size; i < end; ++i) {
+                consume(id, first + i, hash_key<Hasher>(block[i], seed));
+            }
+        });
+        // if reading fails, the destructor of workers waits for them
+        const uint64_t size = std::min(block_size, num_keys - num_read_keys);
+        read_block(blocks[(round + 1) % 2], size);
+        num_read_keys += size;
+        workers.wait();
+        first += block.size();
+    }
+}
+
+/*
+    Return the (sorted) positions of the keys that are equal to a previous key,
+    reporting them to config.duplicate_keys_callback.
+    Only keys with equal hash codes are compared, so any seed works.
+*/
+template <typename Hasher, typename RandomAccessIterator>
+std::vector<uint64_t> find_duplicate_keys(RandomAccessIterator keys, const uint64_t num_keys,
+                                          build_configuration const& config)  //
+{
+    typedef typename Hasher::hash_type hash_type;
+    std::vector<std::pair<hash_type, uint64_t>> hashes(num_keys);
+    for (uint64_t i = 0; i != num_keys; ++i) {
+        hashes[i] = {hash_key<Hasher>(keys[i], config.seed), i};
+    }
+    std::sort(hashes.begin(), hashes.end(), [](auto const& x, auto const& y) {
+        if (x.first.first() != y.first.first()) return x.first.first() < y.first.first();
+        if (x.first.second() != y.first.second()) return x.first.second() < y.first.second();
+        return x.second < y.second;
+    });
+
+    std::vector<uint64_t> duplicates;
+    for (uint64_t begin = 0; begin != num_keys;) {
+        uint64_t end = begin + 1;
+        while (end != num_keys and hashes[end].first.first() == hashes[begin].first.first() and
+               hashes[end].first.second() == hashes[begin].first.second()) {
+            ++end;
+        }
+        /* equal hash codes: compare the keys, since they may just collide */
+        for (uint64_t i = begin + 1; i != end; ++i) {
+            for (uint64_t j = begin; j != i; ++j) {
+                if (keys[hashes[i].second] == keys[hashes[j].second]) {
+                    duplicates.push_back(hashes[i].second);
+                    if (config.duplicate_keys_callback) {
+                        config.duplicate_keys_callback(hashes[i].second, hashes[j].second);
+                    }
+                    break;
+                }
+            }
+        }
+        begin = end;
+    }
+    std::sort(duplicates.begin(), duplicates.end());
+    return duplicates;
+}
+
+/*
+    Return the positions of the keys to build the function for, excluding duplicate keys,
+    or an empty vector if there are no duplicates.
+    Throw duplicate_keys_error if there are duplicates but config.drop_duplicate_keys is false.
+*/
+template <typename Hasher, typename RandomAccessIterator>
+std::vector<uint64_t> check_duplicate_keys(RandomAccessIterator keys, const uint64_t num_keys,
+                                           build_configuration const& config)  //
+{
+    std::vector<uint64_t> positions;
+    auto duplicates = find_duplicate_keys<Hasher>(keys, num_keys, config);
+    if (duplicates.empty()) return positions;
+    if (config.verbose) {
+        std::cout << "found " << duplicates.size() << " duplicate keys" << std::endl;
+    }
+    if (!config.drop_duplicate_keys) throw duplicate_keys_error();
+    positions.reserve(num_keys - duplicates.size());
+    for (uint64_t i = 0, j = 0; i != num_keys; ++i) {
+        if (j != duplicates.size() and duplicates[j] == i) {
+            ++j;
+            continue;
+        }
+        positions.push_back(i);
+    }
+    return positions;
+}
+
+/* Iterate over the keys at the given positions. */
+template <typename RandomAccessIterator>
+struct subset_iterator {
+    using value_type = typename std::iterator_traits<RandomAccessIterator>::value_type;
+    using difference_type = std::ptrdiff_t;
+    using pointer = value_type*;
+    using reference = value_type&;
+    using iterator_category = std::random_access_iterator_tag;
+
+    subset_iterator(RandomAccessIterator keys, std::vector<uint64_t> const& positions,
+                    const uint64_t pos = 0)
+        : m_keys(keys), m_positions(&positions), m_pos(pos) {}
+
+    inline decltype(auto) operator*() const {
+        return m_keys[(*m_positions)[m_pos]];
+    }
+
+    inline decltype(auto) operator[](const uint64_t i) const {
+        return m_keys[(*m_positions)[m_pos + i]];
+    }
+
+    inline void operator++() {
+        ++m_pos;
+    }
+
+    inline subset_iterator operator+(const uint64_t offset) const {
+        return subset_iterator(m_keys, *m_positions, m_pos + offset);
+    }
+
+private:
+    RandomAccessIterator m_keys;
+    std::vector<uint64_t> const* m_positions;
+    uint64_t m_pos;
+};
+
 #pragma pack(push, 4)
 struct bucket_payload_pair {
     bucket_id_type bucket_id;
@@ -222,18 +447,16 @@ void merge_single_block(Pairs const& pairs, Merger& merger, bool verbose) {
     logger.finalize();
 }
 
-template <typename Pairs, typename Merger>
-void merge_multiple_blocks(std::vector<Pairs> const& pairs_blocks, Merger& merger, bool verbose) {
-    uint64_t num_pairs =
-        std::accumulate(pairs_blocks.begin(), pairs_blocks.end(), static_cast<uint64_t>(0),
-                        [](uint64_t sum, Pairs const& pairs) { return sum + pairs.size(); });
-    progress_logger logger(num_pairs, " == merged ", " pairs", verbose);
-
-    // input iterators and heap
-    std::vector<typename Pairs::const_iterator> iterators;
+/*
+    Merge the sorted ranges [iterators[i], ends[i]) of pairs, passing every bucket to the merger.
+    Empty ranges are allowed.
+*/
+template <typename Iterator, typename Merger>
+void merge_ranges(std::vector<Iterator> iterators, std::vector<Iterator> const& ends,
+                  Merger& merger, progress_logger& logger) {
+    assert(iterators.size() == ends.size());
     std::vector<uint32_t> idx_heap;
-    iterators.reserve(pairs_blocks.size());
-    idx_heap.reserve(pairs_blocks.size());
+    idx_heap.reserve(iterators.size());
 
     // heap functions
     auto stdheap_idx_comparator = [&](uint32_t idxa, uint32_t idxb) {
@@ -242,7 +465,7 @@ void merge_multiple_blocks(std::vector<Pairs> const& pairs_blocks, Merger& merge
     auto advance_heap_head = [&]() {
         auto idx = idx_heap[0];
         ++iterators[idx];
-        if (PTHASH_LIKELY(iterators[idx] != pairs_blocks[idx].end())) {
+        if (PTHASH_LIKELY(iterators[idx] != ends[idx])) {
             // percolate down the head
             uint64_t pos = 0;
             uint64_t size = idx_heap.size();
@@ -259,11 +482,11 @@ void merge_multiple_blocks(std::vector<Pairs> const& pairs_blocks, Merger& merge
         }
     };
 
-    // create the input iterators and the heap
-    for (uint64_t i = 0; i != pairs_blocks.size(); ++i) {
-        iterators.push_back(pairs_blocks[i].begin());
-        idx_heap.push_back(i);
+    // create the heap
+    for (uint64_t i = 0; i != iterators.size(); ++i) {
+        if (iterators[i] != ends[i]) idx_heap.push_back(i);
     }
+    if (idx_heap.empty()) return;
     std::make_heap(idx_heap.begin(), idx_heap.end(), stdheap_idx_comparator);
 
     bucket_id_type bucket_id;
@@ -300,16 +523,37 @@ void merge_multiple_blocks(std::vector<Pairs> const& pairs_blocks, Merger& merge
 
     // add the last bucket
     merger.add(bucket_id, bucket_payloads.size(), bucket_payloads.begin());
+}
+
+template <typename Pairs, typename Merger>
+void merge_multiple_blocks(std::vector<Pairs> const& pairs_blocks, Merger& merger, bool verbose) {
+    uint64_t num_pairs =
+        std::accumulate(pairs_blocks.begin(), pairs_blocks.end(), static_cast<uint64_t>(0),
+                        [](uint64_t sum, Pairs const& pairs) { return sum + pairs.size(); });
+    progress_logger logger(num_pairs, " == merged ", " pairs", verbose);
+
+    std::vector<typename Pairs::const_iterator> iterators, ends;
+    iterators.reserve(pairs_blocks.size());
+    ends.reserve(pairs_blocks.size());
+    for (auto const& pairs : pairs_blocks) {
+        iterators.push_back(pairs.begin());
+        ends.push_back(pairs.end());
+    }
+    merge_ranges(std::move(iterators), ends, merger, logger);
     logger.finalize();
 }
 
 template <typename Pairs, typename Merger>
 void merge(std::vector<Pairs> const& pairs_blocks, Merger& merger, bool verbose) {
-    if (pairs_blocks.size() == 1) {
-        merge_single_block(pairs_blocks[0], merger, verbose);
-    } else {
-        merge_multiple_blocks(pairs_blocks, merger, verbose);
+    typedef typename std::iterator_traits<typename Pairs::const_iterator>::iterator_category
+        iterator_category;
+    if constexpr (std::is_base_of_v<std::random_access_iterator_tag, iterator_category>) {
+        if (pairs_blocks.size() == 1) {
+            merge_single_block(pairs_blocks[0], merger, verbose);
+            return;
+        }
     }
+    merge_multiple_blocks(pairs_blocks, merger, verbose);
 }
 
 template <typename Taken, typename FreeSlots>
@@ -362,7 +606,7 @@ struct hash_generator {
     hash_generator(RandomAccessIterator keys, uint64_t seed) : m_iterator(keys), m_seed(seed) {}
 
     inline auto operator*() {
-        return Hasher::hash(*m_iterator, m_seed);
+        return hash_key<Hasher>(*m_iterator, m_seed);
     }
 
     inline void operator++() {
@@ -378,6 +622,28 @@ private:
     uint64_t m_seed;
 };
 
+template <typename HashRandomAccessIterator>
+struct rehash_generator {
+    rehash_generator(HashRandomAccessIterator hashes, uint64_t seed)
+        : m_iterator(hashes), m_seed(seed) {}
+
+    inline auto operator*() {
+        return rehash(*m_iterator, m_seed);
+    }
+
+    inline void operator++() {
+        ++m_iterator;
+    }
+
+    inline rehash_generator operator+(uint64_t offset) const {
+        return rehash_generator(m_iterator + offset, m_seed);
+    }
+
+private:
+    HashRandomAccessIterator m_iterator;
+    uint64_t m_seed;
+};
+
 inline double compute_empirical_entropy(std::vector<uint64_t> const& values) {
     if (values.empty()) return 0.0;
     std::unordered_map<uint64_t, uint64_t> frequency_map;
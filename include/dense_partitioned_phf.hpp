@@ -1,6 +1,9 @@
 #pragma once
 
 #include "builders/internal_memory_builder_partitioned_phf.hpp"
+#include "builders/external_memory_builder_dense_partitioned_phf.hpp"
+#include "builders/hash_collector.hpp"
+#include "utils/fallback.hpp"
 
 namespace pthash {
 
@@ -23,11 +26,35 @@ struct dense_partitioned_phf  //
         return timings;
     }
 
-    // template <typename Iterator>
-    // build_timings build_in_external_memory(Iterator keys, const uint64_t num_keys,
-    //                                        build_configuration const& config) {
-    //     // TODO
-    // }
+    template <typename Iterator>
+    build_timings build_in_external_memory(Iterator keys, const uint64_t num_keys,
+                                           build_configuration const& config) {
+        build_configuration build_config = set_build_configuration(config);
+        external_memory_builder_dense_partitioned_phf<Hasher, Bucketer> builder;
+        auto timings = builder.build_from_keys(keys, num_keys, build_config);
+        timings.encoding_microseconds = build(builder, build_config);
+        return timings;
+    }
+
+    /*
+        Build from the keys added to a collector, whose number need not be known in advance:
+        finalize() marks the end of the input.
+    */
+    build_timings build_in_internal_memory(hash_collector<Hasher>& collector,
+                                           build_configuration const& config) {
+        build_configuration collector_config = config;
+        collector_config.seed = collector.seed();
+        auto keys = collector.finalize();
+        return build_in_internal_memory(keys, collector.size(), collector_config);
+    }
+
+    build_timings build_in_external_memory(hash_collector<Hasher>& collector,
+                                           build_configuration const& config) {
+        build_configuration collector_config = config;
+        collector_config.seed = collector.seed();
+        auto keys = collector.finalize();
+        return build_in_external_memory(keys, collector.size(), collector_config);
+    }
 
     template <typename Builder>
     uint64_t build(Builder& builder, build_configuration const& config)  //
@@ -47,11 +74,21 @@ struct dense_partitioned_phf  //
         m_table_size = builder.table_size();
         m_partitioner = builder.bucketer();
 
-        auto const& builders = builder.builders();
-        m_bucketer = builders.front().bucketer();
+        m_bucketer = builder.partition_bucketer();
 
         m_pilots.encode(builder.interleaving_pilots_iterator_begin(), num_partitions,
-                        num_buckets_per_partition, config.num_threads);
+                        num_buckets_per_partition, config.num_threads, config.pool);
+        m_fallback.build(builder.fallback());
+
+        /* offsets from the global seed of the partitions built with their own seed */
+        std::vector<uint64_t> seed_offsets(num_partitions);
+        bool any_seed_offset = false;
+        for (uint64_t i = 0; i != num_partitions; ++i) {
+            seed_offsets[i] = builder.partition_seed(i) - m_seed;
+            if (seed_offsets[i] != 0) any_seed_offset = true;
+        }
+        m_seed_offsets = compact();
+        if (any_seed_offset) m_seed_offsets.encode(seed_offsets.data(), num_partitions);
 
         if (Minimal and m_num_keys < m_table_size) {
             assert(builder.free_slots().size() == m_table_size - m_num_keys);
@@ -66,10 +103,22 @@ struct dense_partitioned_phf  //
     template <typename T>
     uint64_t operator()(T const& key) const  //
     {
-        auto hash = Hasher::hash(key, m_seed);
+        auto hash = hash_key<Hasher>(key, m_seed);
         const uint64_t partition = m_partitioner.bucket(hash.mix());
-        const uint64_t partition_offset = partition << constants::log2_table_size_per_partition;
-        const uint64_t p = partition_offset + position(hash, partition);
+        if (PTHASH_UNLIKELY(m_seed_offsets.size() != 0)) {
+            const uint64_t seed_offset = m_seed_offsets.access(partition);
+            if (seed_offset != 0) hash = rehash(hash, m_seed + seed_offset);
+        }
+        const uint64_t bucket = m_bucketer.bucket(hash.first());
+        const uint64_t pilot = m_pilots.access(partition, bucket);
+        uint64_t p;
+        if (PTHASH_LIKELY(!m_fallback.bumped(pilot))) {
+            const uint64_t partition_offset = partition
+                                              << constants::log2_table_size_per_partition;
+            p = partition_offset + position(hash, pilot);
+        } else {
+            p = m_fallback.position(hash.second());  // already a global position
+        }
         if constexpr (Minimal) {
             if (PTHASH_LIKELY(p < num_keys())) return p;
             return m_free_slots.access(p - num_keys());
@@ -77,18 +126,17 @@ struct dense_partitioned_phf  //
         return p;
     }
 
+    /* Position within the partition of a key whose bucket has the given pilot. */
     uint64_t position(typename Hasher::hash_type hash,  //
-                      const uint64_t partition) const   //
+                      const uint64_t pilot) const       //
     {
-        const uint64_t bucket = m_bucketer.bucket(hash.first());
-        const uint64_t pilot = m_pilots.access(partition, bucket);
         const uint64_t hashed_pilot = mix(pilot);
         return remap128(mix(hash.second() ^ hashed_pilot), constants::table_size_per_partition);
     }
 
     uint64_t num_bits_for_pilots() const {
         return 8 * (sizeof(m_seed) + sizeof(m_num_keys) + sizeof(m_table_size)) +
-               m_pilots.num_bits();
+               m_pilots.num_bits() + m_seed_offsets.num_bits() + m_fallback.num_bits();
     }
 
     uint64_t num_bits_for_mapper() const {
@@ -130,7 +178,9 @@ private:
         visitor.visit(t.m_partitioner);
         visitor.visit(t.m_bucketer);
         visitor.visit(t.m_pilots);
+        visitor.visit(t.m_seed_offsets);
         visitor.visit(t.m_free_slots);
+        visitor.visit(t.m_fallback);
     }
 
     static build_configuration set_build_configuration(build_configuration const& config) {
@@ -158,8 +208,10 @@ private:
     range_bucketer m_partitioner;
     Bucketer m_bucketer;
     Encoder m_pilots;
+    compact m_seed_offsets;  // empty if all partitions use the global seed
 
     bits::elias_fano<false, false> m_free_slots;
+    fallback m_fallback;
 };
 
 template <typename Hasher>
@@ -80,6 +80,26 @@ public:
         return timings;
     }
 
+    /*
+        Build from the keys added to a collector, whose number need not be known in advance:
+        finalize() marks the end of the input.
+    */
+    build_timings build_in_internal_memory(hash_collector<Hasher>& collector,
+                                           build_configuration const& config) {
+        build_configuration collector_config = config;
+        collector_config.seed = collector.seed();
+        auto keys = collector.finalize();
+        return build_in_internal_memory(keys, collector.size(), collector_config);
+    }
+
+    build_timings build_in_external_memory(hash_collector<Hasher>& collector,
+                                           build_configuration const& config) {
+        build_configuration collector_config = config;
+        collector_config.seed = collector.seed();
+        auto keys = collector.finalize();
+        return build_in_external_memory(keys, collector.size(), collector_config);
+    }
+
     template <typename Builder>
     uint64_t build(Builder& builder, build_configuration const& config) {
         auto start = clock_type::now();
@@ -101,31 +121,21 @@ public:
         auto const& builders = builder.builders();
         const uint64_t num_threads = config.num_threads;
 
+        /* the partitions are encoded in parallel, so each one is encoded on a single thread */
+        build_configuration partition_config = config;
+        partition_config.num_threads = 1;
+
         if (num_threads > 1) {
-            std::vector<std::thread> threads(num_threads);
-            auto exe = [&](uint64_t begin, uint64_t end) {
-                for (; begin != end; ++begin) {
-                    partitions[begin].offset = offsets[begin];
-                    partitions[begin].f.build(builders[begin], config);
-                }
+            /* not sorted by size: the builders of an external build are loaded from disk */
+            auto exe = [&](uint64_t /* thread */, uint64_t i) {
+                partitions[i].offset = offsets[i];
+                partitions[i].f.build(builders[i], partition_config);
             };
-
-            const uint64_t num_partitions_per_thread =
-                (num_partitions + num_threads - 1) / num_threads;
-            for (uint64_t t = 0, begin = 0; t != num_threads; ++t) {
-                uint64_t end = begin + num_partitions_per_thread;
-                if (end > num_partitions) end = num_partitions;
-                threads[t] = std::thread(exe, begin, end);
-                begin = end;
-            }
-
-            for (auto& t : threads) {
-                if (t.joinable()) t.join();
-            }
+            get_thread_pool(config.pool).parallel_for(num_threads, num_partitions, exe);
         } else {
             for (uint64_t i = 0; i != num_partitions; ++i) {
                 partitions[i].offset = offsets[i];
-                partitions[i].f.build(builders[i], config);
+                partitions[i].f.build(builders[i], partition_config);
             }
         }
 
@@ -138,13 +148,15 @@ public:
 
     template <typename T>
     uint64_t operator()(T const& key) const {
-        auto hash = Hasher::hash(key, m_seed);
+        auto hash = hash_key<Hasher>(key, m_seed);
         return position(hash);
     }
 
     uint64_t position(typename Hasher::hash_type hash) const {
         auto b = m_partitioner.bucket(hash.mix());
         auto const& p = m_partitions[b];
+        /* the partition was built with its own seed: see build_partition */
+        if (PTHASH_UNLIKELY(p.f.seed() != m_seed)) hash = rehash(hash, p.f.seed());
         return p.offset + p.f.position(hash);
     }
 
@@ -4,4 +4,5 @@
 #include "utils/dense_encoders.hpp"
 #include "single_phf.hpp"
 #include "partitioned_phf.hpp"
-#include "dense_partitioned_phf.hpp"
\ No newline at end of file
+#include "dense_partitioned_phf.hpp"
+#include "builders/hash_collector.hpp"
\ No newline at end of file
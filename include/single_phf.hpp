@@ -4,6 +4,8 @@
 #include "builders/util.hpp"
 #include "builders/internal_memory_builder_single_phf.hpp"
 #include "builders/external_memory_builder_single_phf.hpp"
+#include "builders/hash_collector.hpp"
+#include "utils/fallback.hpp"
 
 namespace pthash {
 
@@ -36,6 +38,26 @@ struct single_phf  //
         return timings;
     }
 
+    /*
+        Build from the keys added to a collector, whose number need not be known in advance:
+        finalize() marks the end of the input.
+    */
+    build_timings build_in_internal_memory(hash_collector<Hasher>& collector,
+                                           build_configuration const& config) {
+        build_configuration collector_config = config;
+        collector_config.seed = collector.seed();
+        auto keys = collector.finalize();
+        return build_in_internal_memory(keys, collector.size(), collector_config);
+    }
+
+    build_timings build_in_external_memory(hash_collector<Hasher>& collector,
+                                           build_configuration const& config) {
+        build_configuration collector_config = config;
+        collector_config.seed = collector.seed();
+        auto keys = collector.finalize();
+        return build_in_external_memory(keys, collector.size(), collector_config);
+    }
+
     template <typename Builder>
     uint64_t build(Builder const& builder, build_configuration const& config) {
         auto start = clock_type::now();
@@ -46,14 +68,31 @@ struct single_phf  //
         }
 
         m_seed = builder.seed();
+        m_salt = builder.salt();
         m_num_keys = builder.num_keys();
         m_table_size = builder.table_size();
         m_bucketer = builder.bucketer();
-        m_pilots.encode(builder.pilots().data(), m_bucketer.num_buckets());
-        if (Minimal and m_num_keys < m_table_size) {
-            assert(builder.free_slots().size() == m_table_size - m_num_keys);
-            m_free_slots.encode(builder.free_slots().begin(), m_table_size - m_num_keys);
+        auto encode_free_slots = [&]() {
+            if (Minimal and m_num_keys < m_table_size) {
+                assert(builder.free_slots().size() == m_table_size - m_num_keys);
+                m_free_slots.encode(builder.free_slots().begin(), m_table_size - m_num_keys);
+            }
+        };
+        if (config.num_threads > 1) {
+            /* the free slots are encoded on one thread while the pilots are on the others */
+            get_thread_pool(config.pool).run(2, [&](uint64_t i) {
+                if (i == 0) {
+                    m_pilots.encode(builder.pilots().data(), m_bucketer.num_buckets(),
+                                    config.num_threads - 1, config.pool);
+                } else {
+                    encode_free_slots();
+                }
+            });
+        } else {
+            m_pilots.encode(builder.pilots().data(), m_bucketer.num_buckets());
+            encode_free_slots();
         }
+        m_fallback.build(builder.fallback());
         auto stop = clock_type::now();
 
         return to_microseconds(stop - start);
@@ -61,15 +100,21 @@ struct single_phf  //
 
     template <typename T>
     uint64_t operator()(T const& key) const {
-        auto hash = Hasher::hash(key, m_seed);
+        auto hash = hash_key<Hasher>(key, m_seed);
+        if (PTHASH_UNLIKELY(m_salt != constants::invalid_seed)) hash = rehash(hash, m_salt);
         return position(hash);
     }
 
     uint64_t position(typename Hasher::hash_type hash) const {
         const uint64_t bucket = m_bucketer.bucket(hash.first());
         const uint64_t pilot = m_pilots.access(bucket);
-        const uint64_t hashed_pilot = mix(pilot);
-        uint64_t p = remap128(mix(hash.second() ^ hashed_pilot), m_table_size);
+        uint64_t p;
+        if (PTHASH_LIKELY(!m_fallback.bumped(pilot))) {
+            const uint64_t hashed_pilot = mix(pilot);
+            p = remap128(mix(hash.second() ^ hashed_pilot), m_table_size);
+        } else {
+            p = m_fallback.position(hash.second());
+        }
         if constexpr (Minimal) {
             if (PTHASH_LIKELY(p < num_keys())) return p;
             return m_free_slots.access(p - num_keys());
@@ -78,8 +123,8 @@ struct single_phf  //
     }
 
     uint64_t num_bits_for_pilots() const {
-        return 8 * (sizeof(m_seed) + sizeof(m_num_keys) + sizeof(m_table_size)) +
-               m_pilots.num_bits();
+        return 8 * (sizeof(m_seed) + sizeof(m_salt) + sizeof(m_num_keys) + sizeof(m_table_size)) +
+               m_pilots.num_bits() + m_fallback.num_bits();
     }
 
     uint64_t num_bits_for_mapper() const {
@@ -116,11 +161,13 @@ private:
     template <typename Visitor, typename T>
     static void visit_impl(Visitor& visitor, T&& t) {
         visitor.visit(t.m_seed);
+        visitor.visit(t.m_salt);
         visitor.visit(t.m_num_keys);
         visitor.visit(t.m_table_size);
         visitor.visit(t.m_bucketer);
         visitor.visit(t.m_pilots);
         visitor.visit(t.m_free_slots);
+        visitor.visit(t.m_fallback);
     }
 
     static build_configuration set_build_configuration(build_configuration const& config) {
@@ -136,11 +183,13 @@ private:
     }
 
     uint64_t m_seed;
+    uint64_t m_salt;
     uint64_t m_num_keys;
     uint64_t m_table_size;
     Bucketer m_bucketer;
     Encoder m_pilots;
     bits::elias_fano<false, false> m_free_slots;
+    fallback m_fallback;
 };
 
 }  // namespace pthash
\ No newline at end of file
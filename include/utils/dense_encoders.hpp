@@ -7,6 +7,7 @@
 #include <sstream>
 
 #include "encoders.hpp"
+#include "thread_pool.hpp"
 
 namespace pthash {
 
@@ -15,12 +16,13 @@ struct dense_encoder {};
 template <typename Encoder>
 struct dense_mono : dense_encoder {
     template <typename Iterator>
-    void encode(Iterator begin,                                                            //
-                const uint64_t num_partitions,                                             //
-                const uint64_t num_buckets_per_partition, const uint64_t /*num_threads*/)  //
+    void encode(Iterator begin,                                                        //
+                const uint64_t num_partitions,                                         //
+                const uint64_t num_buckets_per_partition, const uint64_t num_threads,
+                thread_pool* pool = nullptr)  //
     {
         m_num_partitions = num_partitions;
-        m_encoder.encode(begin, num_partitions * num_buckets_per_partition);
+        m_encoder.encode(begin, num_partitions * num_buckets_per_partition, num_threads, pool);
     }
 
     static std::string name() {
@@ -66,7 +68,8 @@ struct dense_interleaved : dense_encoder {
     template <typename Iterator>
     void encode(Iterator begin,                                                        //
                 const uint64_t num_partitions,                                         //
-                const uint64_t num_buckets_per_partition, const uint64_t num_threads)  //
+                const uint64_t num_buckets_per_partition, const uint64_t num_threads,
+                thread_pool* pool = nullptr)  //
     {
         std::vector<Encoder> encoders;
         encoders.resize(num_buckets_per_partition);
@@ -82,21 +85,15 @@ struct dense_interleaved : dense_encoder {
                 }
             };
 
-            std::vector<std::thread> threads(num_threads);
-            uint64_t currentEncoder = 0;
-            uint64_t i = 0;
             const uint64_t enc_per_thread =
                 (num_buckets_per_partition + num_threads - 1) / num_threads;
-            while (currentEncoder < num_buckets_per_partition) {
-                uint64_t endEncoder = currentEncoder + enc_per_thread;
-                if (endEncoder > num_buckets_per_partition) endEncoder = num_buckets_per_partition;
-                threads[i] = std::thread(exe, currentEncoder, endEncoder);
-                currentEncoder = endEncoder;
-                i++;
-            }
-            for (auto& t : threads) {
-                if (t.joinable()) t.join();
-            }
+            get_thread_pool(pool).run(num_threads, [&](uint64_t i) {
+                const uint64_t beginEncoder =
+                    std::min(i * enc_per_thread, num_buckets_per_partition);
+                const uint64_t endEncoder =
+                    std::min(beginEncoder + enc_per_thread, num_buckets_per_partition);
+                exe(beginEncoder, endEncoder);
+            });
         }
         m_encoders = std::move(encoders);
     }
@@ -5,6 +5,7 @@
 #include "elias_fano.hpp"
 #include "ranked_sequence.hpp"
 #include "rice_sequence.hpp"
+#include "thread_pool.hpp"
 
 #include <vector>
 #include <cassert>
@@ -13,7 +14,8 @@ namespace pthash {
 
 struct compact {
     template <typename Iterator>
-    void encode(Iterator begin, const uint64_t n) {
+    void encode(Iterator begin, const uint64_t n, const uint64_t /*num_threads*/ = 1,
+                thread_pool* /*pool*/ = nullptr) {
         if (n == 0) return;
         m_values.build(begin, n);
     }
@@ -52,37 +54,53 @@ struct partitioned_compact {
     static const uint64_t partition_size = 256;
     static_assert(partition_size > 0);
 
+    /*
+        The partitions are split into num_threads chunks of consecutive partitions, each encoded
+        in its own bit vector; the bit vectors are then concatenated in order. So the result
+        does not depend on the number of threads.
+    */
     template <typename Iterator>
-    void encode(Iterator begin, const uint64_t n) {
+    void encode(Iterator begin, const uint64_t n, const uint64_t num_threads = 1,
+                thread_pool* pool = nullptr) {
+        m_size = n;
         if (n == 0) return;
-        uint64_t num_partitions = (n + partition_size - 1) / partition_size;
-        bits::bit_vector::builder bvb;
-        bvb.reserve(32 * n);
-        std::vector<uint32_t> bits_per_value;
-        bits_per_value.reserve(num_partitions + 1);
-        bits_per_value.push_back(0);
-        for (uint64_t i = 0, begin_partition = 0; i != num_partitions; ++i) {
-            uint64_t end_partition = begin_partition + partition_size;
-            if (end_partition > n) end_partition = n;
-            uint64_t max_value = *std::max_element(begin + begin_partition, begin + end_partition);
-            uint64_t num_bits = (max_value == 0) ? 1 : std::ceil(std::log2(max_value + 1));
-            assert(num_bits > 0);
-
-            // std::cout << i << ": " << num_bits << '\n';
-            // for (uint64_t k = begin_partition; k != end_partition; ++k) {
-            //     uint64_t num_bits_val = (begin[k] == 0) ? 1 : std::ceil(std::log2(begin[k] +
-            //     1)); std::cout << "  " << num_bits_val << '/' << num_bits << '\n';
-            // }
-
-            for (uint64_t k = begin_partition; k != end_partition; ++k) {
-                bvb.append_bits(*(begin + k), num_bits);
+        const uint64_t num_partitions = (n + partition_size - 1) / partition_size;
+        const uint64_t max_num_chunks = std::max<uint64_t>(num_threads, 1);
+        const uint64_t partitions_per_chunk =
+            (num_partitions + max_num_chunks - 1) / max_num_chunks;
+        const uint64_t num_chunks =
+            (num_partitions + partitions_per_chunk - 1) / partitions_per_chunk;
+        std::vector<uint32_t> bits_per_value(num_partitions + 1);
+        std::vector<bits::bit_vector::builder> chunks(num_chunks);
+        get_thread_pool(pool).run(num_chunks, [&](uint64_t c) {
+            const uint64_t first = c * partitions_per_chunk;
+            const uint64_t last = std::min(first + partitions_per_chunk, num_partitions);
+            auto& bvb = chunks[c];
+            bvb.reserve(32 * (std::min(last * partition_size, n) - first * partition_size));
+            for (uint64_t i = first; i != last; ++i) {
+                uint64_t begin_partition = i * partition_size;
+                uint64_t end_partition = std::min(begin_partition + partition_size, n);
+                uint64_t max_value =
+                    *std::max_element(begin + begin_partition, begin + end_partition);
+                uint64_t num_bits = (max_value == 0) ? 1 : std::ceil(std::log2(max_value + 1));
+                assert(num_bits > 0);
+                for (uint64_t k = begin_partition; k != end_partition; ++k) {
+                    bvb.append_bits(*(begin + k), num_bits);
+                }
+                bits_per_value[i + 1] = num_bits;
             }
-            assert(bits_per_value.back() + num_bits < (1ULL << 32));
-            bits_per_value.push_back(bits_per_value.back() + num_bits);
-            begin_partition = end_partition;
+        });
+        bits_per_value[0] = 0;
+        for (uint64_t i = 0; i != num_partitions; ++i) {
+            assert(bits_per_value[i] + bits_per_value[i + 1] < (1ULL << 32));
+            bits_per_value[i + 1] += bits_per_value[i];
+        }
+        for (uint64_t c = 1; c != num_chunks; ++c) {
+            chunks.front().append(chunks[c]);
+            chunks[c].clear();
         }
         m_bits_per_value = std::move(bits_per_value);
-        bvb.build(m_values);
+        chunks.front().build(m_values);
     }
 
     static std::string name() {
@@ -131,7 +149,8 @@ private:
 
 struct dictionary {
     template <typename Iterator>
-    void encode(Iterator begin, const uint64_t n) {
+    void encode(Iterator begin, const uint64_t n, const uint64_t /*num_threads*/ = 1,
+                thread_pool* /*pool*/ = nullptr) {
         if (n == 0) return;
         m_values.encode(begin, n);
     }
@@ -168,7 +187,8 @@ private:
 
 struct elias_fano {
     template <typename Iterator>
-    void encode(Iterator begin, const uint64_t n) {
+    void encode(Iterator begin, const uint64_t n, const uint64_t /*num_threads*/ = 1,
+                thread_pool* /*pool*/ = nullptr) {
         if (n == 0) return;
         m_values.encode(begin, n);
     }
@@ -206,7 +226,8 @@ private:
 
 struct rice {
     template <typename Iterator>
-    void encode(Iterator begin, const uint64_t n) {
+    void encode(Iterator begin, const uint64_t n, const uint64_t /*num_threads*/ = 1,
+                thread_pool* /*pool*/ = nullptr) {
         if (n == 0) return;
         m_values.encode(begin, n);
     }
@@ -244,11 +265,25 @@ private:
 template <typename Front, typename Back>
 struct dual {
     template <typename Iterator>
-    void encode(Iterator begin, const uint64_t n) {
+    void encode(Iterator begin, const uint64_t n, const uint64_t num_threads = 1,
+                thread_pool* pool = nullptr) {
         if (n == 0) return;
         uint64_t front_size = n * constants::b;
-        m_front.encode(begin, front_size);
-        m_back.encode(begin + front_size, n - front_size);
+        if (num_threads <= 1) {
+            m_front.encode(begin, front_size);
+            m_back.encode(begin + front_size, n - front_size);
+            return;
+        }
+        /* the two sequences are independent: encode them concurrently */
+        const uint64_t front_threads = num_threads - num_threads / 2;
+        get_thread_pool(pool).run(2, [&](uint64_t i) {
+            if (i == 0) {
+                m_front.encode(begin, front_size, front_threads, pool);
+            } else {
+                m_back.encode(begin + front_size, n - front_size, num_threads - front_threads,
+                              pool);
+            }
+        });
     }
 
     static std::string name() {
@@ -0,0 +1,89 @@
+#pragma once
+
+#include "utils/bucketers.hpp"
+#include "utils/encoders.hpp"
+#include "utils/hasher.hpp"
+
+namespace pthash {
+
+/*
+    Compressed counterpart of fallback_builder: resolves the keys of bumped buckets,
+    i.e., the ones whose pilot is equal to bumped_pilot().
+*/
+struct fallback {
+    fallback()
+        : m_bumped_pilot(constants::unbounded_num_pilot_trials)
+        , m_seed(0)
+        , m_salt(constants::invalid_seed)
+        , m_table_size(0) {}
+
+    template <typename Builder>
+    void build(Builder const& builder) {
+        m_bumped_pilot = builder.bumped_pilot();
+        m_seed = builder.seed();
+        m_salt = builder.salt();
+        m_table_size = builder.table_size();
+        m_bucketer = builder.bucketer();
+        m_pilots = compact();
+        m_slots = compact();
+        m_pilots.encode(builder.pilots().data(), builder.pilots().size());
+        m_slots.encode(builder.slots().data(), builder.slots().size());
+    }
+
+    inline bool bumped(const uint64_t pilot) const {
+        return pilot == m_bumped_pilot;
+    }
+
+    uint64_t bumped_pilot() const {
+        return m_bumped_pilot;
+    }
+
+    /* The payload is hash.second() of the key, as seen by search. */
+    uint64_t position(const uint64_t payload) const {
+        assert(m_table_size > 0);
+        auto hash = xxhash_64::hash(payload, m_seed);
+        if (m_salt != constants::invalid_seed) hash = rehash(hash, m_salt);
+        const uint64_t bucket = m_bucketer.bucket(hash.first());
+        const uint64_t pilot = m_pilots.access(bucket);
+        const uint64_t hashed_pilot = mix(pilot);
+        const uint64_t p = remap128(mix(hash.second() ^ hashed_pilot), m_table_size);
+        return m_slots.access(p);
+    }
+
+    uint64_t num_bits() const {
+        return 8 * (sizeof(m_bumped_pilot) + sizeof(m_seed) + sizeof(m_salt) + sizeof(m_table_size)) +
+               m_bucketer.num_bits() + m_pilots.num_bits() + m_slots.num_bits();
+    }
+
+    template <typename Visitor>
+    void visit(Visitor& visitor) const {
+        visit_impl(visitor, *this);
+    }
+
+    template <typename Visitor>
+    void visit(Visitor& visitor) {
+        visit_impl(visitor, *this);
+    }
+
+private:
+    template <typename Visitor, typename T>
+    static void visit_impl(Visitor& visitor, T&& t) {
+        visitor.visit(t.m_bumped_pilot);
+        visitor.visit(t.m_seed);
+        visitor.visit(t.m_salt);
+        visitor.visit(t.m_table_size);
+        visitor.visit(t.m_bucketer);
+        visitor.visit(t.m_pilots);
+        visitor.visit(t.m_slots);
+    }
+
+    uint64_t m_bumped_pilot;
+    uint64_t m_seed;
+    uint64_t m_salt;
+    uint64_t m_table_size;
+    range_bucketer m_bucketer;
+    compact m_pilots;
+    compact m_slots;
+};
+
+}  // namespace pthash
\ No newline at end of file
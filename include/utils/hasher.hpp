@@ -1,5 +1,7 @@
 #pragma once
 
+#include <string_view>
+
 #include <xxh3.h>
 
 namespace pthash {
@@ -83,6 +85,20 @@ private:
     uint64_t m_first, m_second;
 };
 
+/*
+    Derive a new hash code from an existing one and a seed: used to change
+    the hash codes of (a subset of) the keys without hashing them again.
+*/
+static inline hash64 rehash(hash64 const& hash, const uint64_t seed) {
+    const uint64_t h = hash.first();
+    return XXH64(&h, sizeof(h), seed);
+}
+
+static inline hash128 rehash(hash128 const& hash, const uint64_t seed) {
+    const uint64_t h[2] = {hash.first(), hash.second()};
+    return XXH128(h, sizeof(h), seed);
+}
+
 struct xxhash_64 {
     typedef hash64 hash_type;
 
@@ -96,6 +112,11 @@ struct xxhash_64 {
         return XXH64(val.data(), val.size(), seed);
     }
 
+    // specialization for std::string_view, hashed as the std::string of the same bytes
+    static inline hash64 hash(std::string_view val, uint64_t seed) {
+        return XXH64(val.data(), val.size(), seed);
+    }
+
     // specialization for uint64_t
     static inline hash64 hash(uint64_t const& val, uint64_t seed) {
         return XXH64(&val, sizeof(val), seed);
@@ -115,6 +136,11 @@ struct xxhash_128 {
         return XXH128(val.data(), val.size(), seed);
     }
 
+    // specialization for std::string_view, hashed as the std::string of the same bytes
+    static inline hash128 hash(std::string_view val, uint64_t seed) {
+        return XXH128(val.data(), val.size(), seed);
+    }
+
     // specialization for uint64_t
     static inline hash128 hash(uint64_t const& val, uint64_t seed) {
         return XXH128(&val, sizeof(val), seed);
@@ -0,0 +1,194 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace pthash {
+
+/*
+    A set of worker threads that run the parallel sections of the builds, so that
+    these do not create and join fresh threads every time.
+
+    The tasks of a group always run concurrently (some parallel sections, e.g. the
+    parallel search, wait for each other): a group only takes the workers that are idle
+    when it is submitted and runs the remaining tasks on temporary threads. So a pool
+    can be shared by builds running at the same time, and a task can submit a group
+    itself, without deadlocks.
+*/
+struct thread_pool {
+    explicit thread_pool(const uint64_t num_threads) : m_num_idle(0), m_stop(false) {
+        m_workers.reserve(num_threads);
+        for (uint64_t i = 0; i != num_threads; ++i) {
+            m_workers.emplace_back(&thread_pool::work, this);
+        }
+    }
+
+    thread_pool(thread_pool const&) = delete;
+    thread_pool& operator=(thread_pool const&) = delete;
+
+    ~thread_pool() {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stop = true;
+        }
+        m_cv.notify_all();
+        for (auto& worker : m_workers) worker.join();
+    }
+
+    uint64_t num_threads() const {
+        return m_workers.size();
+    }
+
+    /* A group of tasks submitted with async(): wait() returns when all of them are done. */
+    struct task_group {
+        task_group() = default;
+        task_group(task_group&&) = default;
+        task_group& operator=(task_group&&) = delete;
+
+        ~task_group() {
+            try {
+                wait();
+            } catch (...) {
+            }
+        }
+
+        /* Wait for all the tasks and rethrow the first exception raised by any of them. */
+        void wait() {
+            if (!m_state) return;
+            {
+                std::unique_lock<std::mutex> lock(m_state->mutex);
+                m_state->cv.wait(lock, [&] { return m_state->num_running == 0; });
+            }
+            for (auto& t : m_threads) t.join();
+            m_threads.clear();
+            auto error = m_state->error;
+            m_state.reset();
+            if (error) std::rethrow_exception(error);
+        }
+
+    private:
+        friend struct thread_pool;
+
+        struct state {
+            std::mutex mutex;
+            std::condition_variable cv;
+            uint64_t num_running = 0;
+            std::exception_ptr error;
+        };
+
+        std::shared_ptr<state> m_state;
+        std::vector<std::thread> m_threads;  // for the tasks that found no idle worker
+    };
+
+    /* Start f(0), f(1), ..., f(num_tasks - 1) concurrently, without waiting for them. */
+    template <typename Function>
+    task_group async(const uint64_t num_tasks, Function f) {
+        task_group group;
+        if (num_tasks == 0) return group;
+        group.m_state = std::make_shared<task_group::state>();
+        group.m_state->num_running = num_tasks;
+        auto shared_f = std::make_shared<Function>(std::move(f));
+        auto task = [state = group.m_state, shared_f](uint64_t i) {
+            std::exception_ptr error;
+            try {
+                (*shared_f)(i);
+            } catch (...) {
+                error = std::current_exception();
+            }
+            std::lock_guard<std::mutex> lock(state->mutex);
+            if (error and !state->error) state->error = error;
+            if (--state->num_running == 0) state->cv.notify_all();
+        };
+
+        uint64_t num_pooled = 0;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            num_pooled = std::min<uint64_t>(num_tasks, m_num_idle);
+            m_num_idle -= num_pooled;
+            for (uint64_t i = 0; i != num_pooled; ++i) m_jobs.push_back([task, i] { task(i); });
+        }
+        m_cv.notify_all();
+        group.m_threads.reserve(num_tasks - num_pooled);
+        for (uint64_t i = num_pooled; i != num_tasks; ++i) group.m_threads.emplace_back(task, i);
+        return group;
+    }
+
+    /* Run f(0), f(1), ..., f(num_tasks - 1) concurrently, f(0) on the calling thread. */
+    template <typename Function>
+    void run(const uint64_t num_tasks, Function f) {
+        if (num_tasks == 0) return;
+        task_group group = async(num_tasks - 1, [&f](uint64_t i) { f(i + 1); });
+        std::exception_ptr error;
+        try {
+            f(0);
+        } catch (...) {
+            error = std::current_exception();
+        }
+        group.wait();
+        if (error) std::rethrow_exception(error);
+    }
+
+    /*
+        Call f(thread, i) for every i in [0, n) on num_threads threads, each taking the next i
+        from a shared cursor as soon as it is done with the previous one: unlike a static
+        split in ranges, this balances tasks of uneven cost.
+    */
+    template <typename Function>
+    void parallel_for(const uint64_t num_threads, const uint64_t n, Function f) {
+        std::atomic<uint64_t> next(0);
+        run(std::min(num_threads, n), [&](uint64_t thread) {
+            try {
+                for (uint64_t i; (i = next.fetch_add(1, std::memory_order_relaxed)) < n;) {
+                    f(thread, i);
+                }
+            } catch (...) {
+                next = n;  // the other threads stop at their next task
+                throw;
+            }
+        });
+    }
+
+private:
+    void work() {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        while (true) {
+            /* m_num_idle = number of waiting workers - number of queued jobs */
+            ++m_num_idle;
+            m_cv.wait(lock, [&] { return m_stop or !m_jobs.empty(); });
+            if (m_jobs.empty()) return;
+            auto job = std::move(m_jobs.front());
+            m_jobs.pop_front();
+            lock.unlock();
+            job();
+            lock.lock();
+        }
+    }
+
+    uint64_t m_num_idle;
+    bool m_stop;
+    std::deque<std::function<void()>> m_jobs;
+    std::mutex m_mutex;
+    std::condition_variable m_cv;
+    std::vector<std::thread> m_workers;  // last, so that they start after the other members
+};
+
+/* The pool used when the build configuration does not provide one. */
+static inline thread_pool& default_thread_pool() {
+    static thread_pool pool(std::thread::hardware_concurrency());
+    return pool;
+}
+
+static inline thread_pool& get_thread_pool(thread_pool* pool) {
+    return pool ? *pool : default_thread_pool();
+}
+
+}  // namespace pthash
\ No newline at end of file
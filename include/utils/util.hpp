@@ -7,6 +7,7 @@
 #include "hasher.hpp"
 
 #define PTHASH_LIKELY(expr) __builtin_expect((bool)(expr), true)
+#define PTHASH_UNLIKELY(expr) __builtin_expect((bool)(expr), false)
 
 namespace pthash {
 
@@ -20,6 +21,7 @@ static const uint64_t available_ram = sysconf(_SC_PAGESIZE) * sysconf(_SC_PHYS_P
 static const uint64_t invalid_seed = uint64_t(-1);
 static const uint64_t invalid_num_buckets = uint64_t(-1);
 static const uint64_t invalid_table_size = uint64_t(-1);
+static const uint64_t unbounded_num_pilot_trials = uint64_t(-1);
 static const double default_alpha = 0.94;
 
 /* for partitioned_phf */
@@ -300,11 +300,9 @@ template <typename Hasher, typename Bucketer, typename Iterator>
 void choose_builder(build_parameters<Iterator> const& params, build_configuration const& config) {
     if (config.dense_partitioning) {
         if (params.external_memory) {
-            std::cerr
-                << "Error: External memory construction for dense_partitioned_phf has not been "
-                   "implemented yet"
-                << std::endl;
-            return;
+            choose_minimal<phf_type::dense_partitioned,  //
+                           external_memory_builder_dense_partitioned_phf<Hasher, Bucketer>>(
+                params, config);
         } else {
             choose_minimal<phf_type::dense_partitioned,  //
                            internal_memory_builder_partitioned_phf<Hasher, Bucketer>>(params,
@@ -348,8 +346,10 @@ void choose_bucketer(build_parameters<Iterator> const& params, build_configurati
     }
 }
 
+/* A seed other than constants::invalid_seed is the one the keys were hashed with. */
 template <typename Iterator>
-void build(cmd_line_parser::parser const& parser, Iterator keys, uint64_t num_keys) {
+void build(cmd_line_parser::parser const& parser, Iterator keys, uint64_t num_keys,
+           uint64_t seed = constants::invalid_seed) {
     build_parameters<Iterator> params(keys, num_keys);
     params.input_filename = parser.get<std::string>("input_filename");
     params.output_filename =
@@ -357,6 +357,10 @@ void build(cmd_line_parser::parser const& parser, Iterator keys, uint64_t num_ke
     params.external_memory = parser.get<bool>("external_memory");
     params.check = parser.get<bool>("check");
     params.num_queries = parser.get<uint64_t>("num_queries");
+    if constexpr (std::is_same_v<Iterator, hash_collector<xxhash_128>::iterator>) {
+        /* the lookups of prehashed keys would not account for hashing */
+        params.num_queries = 0;
+    }
     params.encoder_type = parser.get<std::string>("encoder_type");
     params.bucketer_type = parser.get<std::string>("bucketer_type");
 
@@ -420,7 +424,14 @@ void build(cmd_line_parser::parser const& parser, Iterator keys, uint64_t num_ke
     }
 
     if (parser.parsed("seed")) config.seed = parser.get<uint64_t>("seed");
+    if (seed != constants::invalid_seed) config.seed = seed;
+    if (parser.parsed("max_num_pilot_trials")) {
+        config.max_num_pilot_trials = parser.get<uint64_t>("max_num_pilot_trials");
+    }
     if (parser.parsed("tmp_dir")) config.tmp_dir = parser.get<std::string>("tmp_dir");
+    config.compress_tmp_files = parser.get<bool>("compress_tmp_files");
+    config.bypass_page_cache = parser.get<bool>("bypass_page_cache");
+    config.checkpoint = parser.get<bool>("checkpoint");
 
     if (parser.parsed("ram")) {
         uint64_t ram = parser.get<double>("ram") * essentials::GB;
@@ -441,12 +452,45 @@ void build(cmd_line_parser::parser const& parser, Iterator keys, uint64_t num_ke
     choose_bucketer<xxhash_128>(params, config);
 }
 
+/*
+    Hash the first max_num_keys lines of the input into the collector, or all of them, so that
+    their number need not be known in advance: a block of lines is read while the previous
+    one is hashed by the other threads.
+*/
+template <typename Hasher>
+void collect_lines(std::istream& is, hash_collector<Hasher>& collector, const uint64_t num_threads,
+                   uint64_t max_num_keys = uint64_t(-1)) {
+    constexpr uint64_t block_size = 1 << 20;
+    auto read_block = [&](std::vector<std::string>& block) {
+        block.clear();
+        std::string s;
+        while (max_num_keys != 0 and block.size() != block_size and std::getline(is, s)) {
+            block.push_back(std::move(s));
+            --max_num_keys;
+        }
+    };
+    const uint64_t num_hashing_threads = std::max<uint64_t>(num_threads, 2) - 1;
+    std::vector<std::string> block, next_block;
+    read_block(block);
+    while (!block.empty()) {
+        default_thread_pool().run(num_hashing_threads + 1, [&](uint64_t thread) {
+            if (thread == 0) {
+                read_block(next_block);
+                return;
+            }
+            const uint64_t begin = block.size() * (thread - 1) / num_hashing_threads;
+            const uint64_t end = block.size() * thread / num_hashing_threads;
+            collector.add_batch(block.begin() + begin, block.begin() + end);
+        });
+        block.swap(next_block);
+    }
+}
+
 int main(int argc, char** argv) {
     cmd_line_parser::parser parser(argc, argv);
 
     /* Required arguments. */
     constexpr bool REQUIRED = true;
-    parser.add("num_keys", "The size of the input.", "-n", REQUIRED);
     parser.add("lambda",
                "A constant that trades construction speed for space effectiveness. "
                "A reasonable value lies between 3.0 and 10.0.",
@@ -465,6 +509,10 @@ int main(int argc, char** argv) {
 
     /* Optional arguments. */
     constexpr bool OPTIONAL = !REQUIRED;
+    parser.add("num_keys",
+               "The size of the input. If this is not provided, then all the keys of the input "
+               "file are used.",
+               "-n", OPTIONAL);
     parser.add("alpha",
                "The table load factor. It must be a quantity > 0 and <= 1 (Default is " +
                    std::to_string(constants::default_alpha) + ").",
@@ -472,15 +520,28 @@ int main(int argc, char** argv) {
     parser.add("avg_partition_size", "Average partition size for HEM.", "-p", OPTIONAL);
     parser.add("seed", "Seed to use for construction.", "-s", OPTIONAL);
     parser.add("num_threads", "Number of threads to use for construction.", "-t", OPTIONAL);
+    parser.add("max_num_pilot_trials",
+               "Maximum number of pilots tried for a bucket before its keys are bumped to a "
+               "fallback function (Default is unbounded).",
+               "-c", OPTIONAL);
     parser.add("input_filename",
                "A string input file name. If this is not provided, then [num_keys] 64-bit random "
                "keys will be used as input. "
                "If, instead, the filename is '-', then input is read from standard input.",
                "-i", OPTIONAL);
+    parser.add("input_format",
+               "The format of the input file: 'text' (one key per line, the default), "
+               "'uint32', 'uint64' (little-endian unsigned integers), 'uint128' (keys of 16 "
+               "bytes), 'nul' (NUL-terminated strings), 'prefixed' (strings preceded by their "
+               "length as a little-endian uint32). Binary files, and text files in external "
+               "memory, are memory-mapped and their keys read in place.",
+               "-f", OPTIONAL);
     parser.add("output_filename", "Output file name where the function will be serialized.", "-o",
                OPTIONAL);
     parser.add("tmp_dir",
-               "Temporary directory used for building in external memory. Default is directory '" +
+               "Temporary directory used for building in external memory. Several directories "
+               "separated by ':' (e.g., one per disk) are used round-robin. Default is "
+               "directory '" +
                    constants::default_tmp_dirname + "'.",
                "-d", OPTIONAL);
     parser.add("ram", "Number of Giga bytes of RAM to use for construction in external memory.",
@@ -491,6 +552,17 @@ int main(int argc, char** argv) {
     parser.add("dense_partitioning", "Activate dense partitioning.", "--dense", OPTIONAL, BOOLEAN);
     parser.add("external_memory", "Build the function in external memory.", "--external", OPTIONAL,
                BOOLEAN);
+    parser.add("compress_tmp_files",
+               "Compress the temporary files written when building in external memory.",
+               "--compress-tmp", OPTIONAL, BOOLEAN);
+    parser.add("bypass_page_cache",
+               "Evict the temporary files written when building in external memory from the "
+               "page cache, so as not to disturb other processes.",
+               "--bypass-page-cache", OPTIONAL, BOOLEAN);
+    parser.add("checkpoint",
+               "Keep a checkpoint of a partitioned build in external memory, so that a build "
+               "with the same parameters and temporary directory resumes after a failure.",
+               "--checkpoint", OPTIONAL, BOOLEAN);
     parser.add("verbose", "Verbose output during construction.", "--verbose", OPTIONAL, BOOLEAN);
     parser.add("check", "Check correctness after construction.", "--check", OPTIONAL, BOOLEAN);
     parser.add("input-cache",
@@ -500,44 +572,105 @@ int main(int argc, char** argv) {
 
     if (!parser.parse()) return 1;
 
-    if (parser.parsed("input_filename") and                                 //
-        parser.get<std::string>("input_filename") == "-" and                //
-        parser.get<bool>("external_memory") and parser.get<bool>("check"))  //
-    {
-        std::cerr << "--input_filename '-' (stdin input) in combination with --external can be "
-                     "used only without --check (lookup time cannot be measured either since "
-                     "input is only read once)"
-                  << std::endl;
+    if (!parser.parsed("num_keys") and !parser.parsed("input_filename")) {
+        std::cerr << "[num_keys] is required to generate random keys" << std::endl;
         return 1;
     }
 
-    auto num_keys = parser.get<uint64_t>("num_keys");
     bool external_memory = parser.get<bool>("external_memory");
+    const uint64_t num_threads =
+        parser.parsed("num_threads") ? parser.get<uint64_t>("num_threads") : 1;
+    const std::string input_format =
+        parser.parsed("input_format") ? parser.get<std::string>("input_format") : "text";
+    const std::string input_filename =
+        parser.parsed("input_filename") ? parser.get<std::string>("input_filename") : "";
+    const bool file_input = input_filename != "" and input_filename != "-";
+
+    /*
+        Keys read in place from a memory-mapped file, through random-access iterators:
+        binary files, and text files in external memory.
+    */
+    if (input_format != "text" or (external_memory and file_input)) {
+        if (!file_input) {
+            std::cerr << "--input_format '" << input_format << "' requires an input file"
+                      << std::endl;
+            return 1;
+        }
+        mm::file_source<uint8_t> input(input_filename);
+        uint8_t const* begin = input.data();
+        uint8_t const* end = input.data() + input.size();
+        auto build_from = [&](auto keys, const uint64_t num_input_keys) {
+            uint64_t num_keys = num_input_keys;
+            if (parser.parsed("num_keys")) {
+                num_keys = parser.get<uint64_t>("num_keys");
+                if (num_keys > num_input_keys) {
+                    throw std::runtime_error("the input has only " +
+                                             std::to_string(num_input_keys) + " keys");
+                }
+            }
+            build(parser, keys, num_keys);
+        };
+        if (input_format == "uint32" or input_format == "uint64") {
+            const uint64_t width = input_format == "uint32" ? sizeof(uint32_t) : sizeof(uint64_t);
+            build_from(binary_uints_iterator(begin, width), input.size() / width);
+        } else if (input_format == "uint128") {
+            const uint64_t width = 2 * sizeof(uint64_t);
+            build_from(string_views_iterator(begin, width), input.size() / width);
+        } else if (input_format == "text" or input_format == "nul") {
+            const uint8_t separator = input_format == "text" ? '\n' : '\0';
+            auto offsets = separated_strings_offsets(begin, end, separator, num_threads);
+            build_from(string_views_iterator(begin, offsets.data(), 1), offsets.size() - 1);
+        } else if (input_format == "prefixed") {
+            auto offsets = length_prefixed_strings_offsets(begin, end);
+            build_from(string_views_iterator(begin, offsets.data(), sizeof(uint32_t)),
+                       offsets.size() - 1);
+        } else {
+            std::cerr << "unknown input format" << std::endl;
+            return 1;
+        }
+        input.close();
+        return 0;
+    }
+
+    /* without [num_keys], or from stdin in external memory, hash the keys as they are read */
+    if (!parser.parsed("num_keys") or (external_memory and input_filename == "-")) {
+        build_configuration config;
+        if (parser.parsed("seed")) config.seed = parser.get<uint64_t>("seed");
+        if (parser.parsed("tmp_dir")) config.tmp_dir = parser.get<std::string>("tmp_dir");
+        if (parser.parsed("ram")) config.ram = parser.get<double>("ram") * essentials::GB;
+        const uint64_t max_num_keys =
+            parser.parsed("num_keys") ? parser.get<uint64_t>("num_keys") : uint64_t(-1);
+        hash_collector<xxhash_128> collector(config);
+        if (input_filename == "-") {
+            collect_lines(std::cin, collector, num_threads, max_num_keys);
+        } else {
+            std::ifstream input(input_filename.c_str());
+            if (!input.good()) throw std::runtime_error("error in opening file.");
+            collect_lines(input, collector, num_threads, max_num_keys);
+            input.close();
+        }
+        if (parser.parsed("num_keys") and collector.size() != max_num_keys) {
+            throw std::runtime_error("the input has only " + std::to_string(collector.size()) +
+                                     " keys");
+        }
+        if (parser.get<bool>("verbose")) std::cout << "num_keys " << collector.size() << std::endl;
+        build(parser, collector.finalize(), collector.size(), collector.seed());
+        return 0;
+    }
+
+    auto num_keys = parser.get<uint64_t>("num_keys");
 
     if (parser.parsed("input_filename")) {
-        auto input_filename = parser.get<std::string>("input_filename");
-        if (external_memory) {
-            if (input_filename == "-") {
-                sequential_lines_iterator keys(std::cin);
-                build(parser, keys, num_keys);
-            } else {
-                mm::file_source<uint8_t> input(input_filename, mm::advice::sequential);
-                lines_iterator keys(input.data(), input.data() + input.size());
-                build(parser, keys, num_keys);
-                input.close();
-            }
+        std::vector<std::string> keys;
+        if (input_filename == "-") {
+            keys = read_string_collection(num_keys, std::cin, parser.get<bool>("verbose"));
         } else {
-            std::vector<std::string> keys;
-            if (input_filename == "-") {
-                keys = read_string_collection(num_keys, std::cin, parser.get<bool>("verbose"));
-            } else {
-                std::ifstream input(input_filename.c_str());
-                if (!input.good()) throw std::runtime_error("error in opening file.");
-                keys = read_string_collection(num_keys, input, parser.get<bool>("verbose"));
-                input.close();
-            }
-            build(parser, keys.begin(), keys.size());
+            std::ifstream input(input_filename.c_str());
+            if (!input.good()) throw std::runtime_error("error in opening file.");
+            keys = read_string_collection(num_keys, input, parser.get<bool>("verbose"));
+            input.close();
         }
+        build(parser, keys.begin(), keys.size());
     } else {
         if (external_memory) {
             std::cout << "Warning: external memory construction with in-memory input" << std::endl;
@@ -582,7 +715,9 @@ int main(int argc, char** argv) {
         }
 
         // build(parser, distinct_strings(num_keys, random_input_seed).begin(), num_keys);
-        build(parser, keys.begin(), num_keys);
+        /* read as a binary input, not to instantiate the builds for one more iterator */
+        build(parser, binary_uints_iterator(reinterpret_cast<uint8_t const*>(keys.data()), 8),
+              num_keys);
     }
 
     return 0;
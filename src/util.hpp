@@ -1,15 +1,18 @@
 #pragma once
 
 #include <chrono>
+#include <cstring>
 #include <fstream>
 #include <iostream>
 #include <iomanip>
 #include <iterator>
 #include <sstream>  // for stringbuf
 #include <string>
+#include <string_view>
 #include <vector>
 
 #include "utils/util.hpp"
+#include "utils/thread_pool.hpp"
 #include "essentials.hpp"
 
 namespace pthash {
@@ -104,6 +107,173 @@ private:
     std::string m_key;
 };
 
+/*
+    Random-access iterator over the little-endian unsigned integers of width 4 or 8 bytes
+    stored back to back in memory, e.g., in a memory-mapped binary file.
+*/
+struct binary_uints_iterator {
+    using value_type = uint64_t;
+    using difference_type = std::ptrdiff_t;
+    using pointer = value_type*;
+    using reference = value_type&;
+    using iterator_category = std::random_access_iterator_tag;
+
+    binary_uints_iterator(uint8_t const* data, const uint64_t width, const uint64_t pos = 0)
+        : m_data(data), m_width(width), m_pos(pos) {
+        assert(width == sizeof(uint32_t) or width == sizeof(uint64_t));
+    }
+
+    inline uint64_t operator*() const {
+        return (*this)[0];
+    }
+
+    inline uint64_t operator[](const uint64_t i) const {
+        uint8_t const* p = m_data + (m_pos + i) * m_width;
+        if (m_width == sizeof(uint32_t)) {
+            uint32_t val;
+            std::memcpy(&val, p, sizeof(uint32_t));
+            return val;
+        }
+        uint64_t val;
+        std::memcpy(&val, p, sizeof(uint64_t));
+        return val;
+    }
+
+    inline binary_uints_iterator& operator++() {
+        ++m_pos;
+        return *this;
+    }
+
+    inline binary_uints_iterator operator+(const uint64_t offset) const {
+        return binary_uints_iterator(m_data, m_width, m_pos + offset);
+    }
+
+private:
+    uint8_t const* m_data;
+    uint64_t m_width;
+    uint64_t m_pos;
+};
+
+/*
+    Random-access iterator over the strings stored back to back in memory, e.g., in a
+    memory-mapped file, yielding views of them instead of copies. The i-th string is either
+    the i-th record of width bytes or, given the offsets of the strings, the bytes from
+    offsets[i] to offsets[i + 1] - gap, where gap is the size of what precedes the next
+    string (its separator or its length prefix).
+*/
+struct string_views_iterator {
+    using value_type = std::string_view;
+    using difference_type = std::ptrdiff_t;
+    using pointer = value_type*;
+    using reference = value_type&;
+    using iterator_category = std::random_access_iterator_tag;
+
+    string_views_iterator(uint8_t const* data, const uint64_t width)
+        : m_data(reinterpret_cast<char const*>(data))
+        , m_offsets(nullptr)
+        , m_width(width)
+        , m_gap(0)
+        , m_pos(0) {}
+
+    string_views_iterator(uint8_t const* data, uint64_t const* offsets, const uint64_t gap)
+        : m_data(reinterpret_cast<char const*>(data))
+        , m_offsets(offsets)
+        , m_width(0)
+        , m_gap(gap)
+        , m_pos(0) {}
+
+    inline std::string_view operator*() const {
+        return (*this)[0];
+    }
+
+    inline std::string_view operator[](const uint64_t i) const {
+        const uint64_t pos = m_pos + i;
+        if (m_offsets) {
+            const uint64_t begin = m_offsets[pos];
+            return std::string_view(m_data + begin, m_offsets[pos + 1] - m_gap - begin);
+        }
+        return std::string_view(m_data + pos * m_width, m_width);
+    }
+
+    inline string_views_iterator& operator++() {
+        ++m_pos;
+        return *this;
+    }
+
+    inline string_views_iterator operator+(const uint64_t offset) const {
+        string_views_iterator it = *this;
+        it.m_pos += offset;
+        return it;
+    }
+
+private:
+    char const* m_data;
+    uint64_t const* m_offsets;
+    uint64_t m_width;
+    uint64_t m_gap;
+    uint64_t m_pos;
+};
+
+/*
+    Offsets of the strings terminated by separator (e.g., '\n' or '\0') in [begin, end), for
+    a string_views_iterator with gap 1. The last string may lack its separator.
+    The input is split in num_threads ranges, whose separators are searched in parallel.
+*/
+std::vector<uint64_t> separated_strings_offsets(uint8_t const* begin, uint8_t const* end,
+                                                const uint8_t separator,
+                                                const uint64_t num_threads = 1) {
+    const uint64_t size = end - begin;
+    const uint64_t num_ranges = std::max<uint64_t>(1, std::min(num_threads, size));
+    std::vector<std::vector<uint64_t>> range_offsets(num_ranges);
+    auto& pool = default_thread_pool();
+    pool.run(num_ranges, [&](uint64_t r) {
+        /* the offsets of the strings that follow the separators of the range */
+        uint8_t const* p = begin + size * r / num_ranges;
+        uint8_t const* range_end = begin + size * (r + 1) / num_ranges;
+        while (p != range_end) {
+            auto q = static_cast<uint8_t const*>(std::memchr(p, separator, range_end - p));
+            if (!q) break;
+            p = q + 1;
+            range_offsets[r].push_back(p - begin);
+        }
+    });
+    std::vector<uint64_t> positions(num_ranges + 1, 1);
+    for (uint64_t r = 0; r != num_ranges; ++r) {
+        positions[r + 1] = positions[r] + range_offsets[r].size();
+    }
+    std::vector<uint64_t> offsets(positions.back(), 0);  // the first string starts at 0
+    pool.run(num_ranges, [&](uint64_t r) {
+        std::copy(range_offsets[r].begin(), range_offsets[r].end(),
+                  offsets.begin() + positions[r]);
+        std::vector<uint64_t>().swap(range_offsets[r]);
+    });
+    if (offsets.back() != size) offsets.push_back(size + 1);  // as if terminated
+    return offsets;
+}
+
+/*
+    Offsets of the strings in [begin, end), each preceded by its length as a little-endian
+    uint32_t, for a string_views_iterator with gap sizeof(uint32_t).
+*/
+std::vector<uint64_t> length_prefixed_strings_offsets(uint8_t const* begin, uint8_t const* end) {
+    std::vector<uint64_t> offsets;
+    const uint64_t size = end - begin;
+    uint64_t pos = 0;
+    while (pos != size) {
+        uint32_t length = 0;
+        if (size - pos >= sizeof(length)) std::memcpy(&length, begin + pos, sizeof(length));
+        if (size - pos < sizeof(length) or length > size - pos - sizeof(length)) {
+            throw std::runtime_error("truncated string after " + std::to_string(offsets.size()) +
+                                     " strings");
+        }
+        pos += sizeof(length);
+        offsets.push_back(pos);
+        pos += length;
+    }
+    offsets.push_back(pos + sizeof(uint32_t));
+    return offsets;
+}
+
 template <typename IStream>
 std::vector<std::string> read_string_collection(uint64_t n, IStream& is, bool verbose) {
     progress_logger logger(n, "read ", " keys from file", verbose);
@@ -49,6 +49,20 @@ void test_internal_memory_dense_partitioned_mphf(Iterator keys, uint64_t num_key
         test_encoder<D_int>(builder_128, config, keys, num_keys);
         test_encoder<EF_mono>(builder_128, config, keys, num_keys);
     }
+
+    /* bound the pilot search so that some buckets are bumped to the fallback function */
+    config.lambda = 6.0;
+    config.max_num_pilot_trials = 16;
+    builder_64.build_from_keys(keys, num_keys, config);
+    test_encoder<C_mono>(builder_64, config, keys, num_keys);
+    test_encoder<R_int>(builder_64, config, keys, num_keys);
+
+    /* external-memory construction, with little RAM so that partitions are built by ranges */
+    external_memory_builder_dense_partitioned_phf<xxhash_64, bucketer_type> external_builder;
+    config.ram = 1'000'000;
+    external_builder.build_from_keys(keys, num_keys, config);
+    test_encoder<C_mono>(external_builder, config, keys, num_keys);
+    test_encoder<R_int>(external_builder, config, keys, num_keys);
 }
 
 int main() {
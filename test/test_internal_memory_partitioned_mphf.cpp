@@ -62,6 +62,100 @@ void test_internal_memory_partitioned_mphf(Iterator keys, uint64_t num_keys) {
             }
         }
     }
+
+    /* keys read line by line, hashed in a pipeline when there are several threads */
+    std::vector<std::string> strings;
+    std::stringstream lines;
+    for (uint64_t i = 0; i != num_keys; ++i) {
+        strings.push_back(std::to_string(keys[i]));
+        lines << strings.back() << '\n';
+    }
+    internal_memory_builder_partitioned_phf<xxhash_64, bucketer_type> strings_builder;
+    config.avg_partition_size = 1'000;
+    const uint64_t max_num_threads = std::min<uint64_t>(4, std::thread::hardware_concurrency());
+    for (uint64_t num_threads = 1; num_threads <= max_num_threads; num_threads *= 2) {
+        config.num_threads = num_threads;
+        lines.clear();
+        lines.seekg(0);
+        strings_builder.build_from_keys(sequential_lines_iterator(lines), num_keys, config);
+        test_encoder<compact>(strings_builder, config, strings.begin(), num_keys);  // C
+    }
+
+    /* keys added concurrently by several threads, spilled to disk by the collector */
+    config.num_threads = 1;
+    config.ram = 1;
+    hash_collector<xxhash_64> collector(config);
+    {
+        const uint64_t num_producers = 3;
+        std::vector<std::thread> producers;
+        for (uint64_t id = 0; id != num_producers; ++id) {
+            producers.emplace_back([&, id]() {
+                if (id == 0) {
+                    collector.add_batch(keys, keys + num_keys / 2);
+                    return;
+                }
+                auto producer = collector.get_producer();
+                for (uint64_t i = num_keys / 2 + id - 1; i < num_keys; i += num_producers - 1) {
+                    producer.add(keys[i]);
+                }
+            });
+        }
+        for (auto& t : producers) t.join();
+    }
+    testing::require_equal(collector.size(), num_keys);
+    auto collected_keys = collector.finalize();
+    config.seed = collector.seed();
+    builder_64.build_from_keys(collected_keys, num_keys, config);
+    test_encoder<compact>(builder_64, config, keys, num_keys);  // C
+    external_memory_builder_partitioned_phf<xxhash_64, bucketer_type> external_builder;
+    config.ram = 1'000'000;
+    external_builder.build_from_keys(collected_keys, num_keys, config);
+    test_encoder<compact>(external_builder, config, keys, num_keys);  // C
+
+    /* the build must use the seed of the collector */
+    config.seed = collector.seed() + 1;
+    bool failed = false;
+    try {
+        builder_64.build_from_keys(collected_keys, num_keys, config);
+    } catch (std::invalid_argument const&) {
+        failed = true;
+    }
+    testing::require_equal(failed, true);
+}
+
+template <typename Hasher>
+void test_duplicate_keys(std::vector<uint64_t> const& keys) {
+    std::cout << "testing with duplicate keys..." << std::endl;
+
+    std::vector<uint64_t> dirty_keys = keys;
+    const uint64_t num_duplicates = keys.size() / 100 + 1;
+    for (uint64_t i = 0; i != num_duplicates; ++i) {
+        dirty_keys.push_back(keys[random_value() % keys.size()]);
+    }
+
+    build_configuration config;
+    config.minimal = true;
+    config.verbose = false;
+    config.seed = random_value();
+    uint64_t num_reported_duplicates = 0;
+    config.duplicate_keys_callback = [&](uint64_t i, uint64_t j) {
+        testing::require_equal(dirty_keys[i], dirty_keys[j]);
+        ++num_reported_duplicates;
+    };
+
+    internal_memory_builder_partitioned_phf<Hasher, bucketer_type> builder;
+    bool failed = false;
+    try {
+        builder.build_from_keys(dirty_keys.begin(), dirty_keys.size(), config);
+    } catch (duplicate_keys_error const&) {
+        failed = true;
+    }
+    testing::require_equal(failed, true);
+    testing::require_equal(num_reported_duplicates, num_duplicates);
+
+    config.drop_duplicate_keys = true;
+    builder.build_from_keys(dirty_keys.begin(), dirty_keys.size(), config);
+    test_encoder<compact>(builder, config, keys.begin(), keys.size());
 }
 
 int main() {
@@ -72,6 +166,8 @@ int main() {
         std::vector<uint64_t> keys = distinct_uints<uint64_t>(num_keys, random_value());
         assert(keys.size() == num_keys);
         test_internal_memory_partitioned_mphf(keys.begin(), keys.size());
+        test_duplicate_keys<xxhash_64>(keys);
+        test_duplicate_keys<xxhash_128>(keys);
     }
     return 0;
 }
@@ -52,6 +52,194 @@ void test_internal_memory_single_mphf(Iterator keys, uint64_t num_keys) {
             test_encoder<elias_fano>(builder_128, config, keys, num_keys);             // EF
         }
     }
+
+    /* bound the pilot search so that some buckets are bumped to the fallback function */
+    config.lambda = 6.0;
+    config.alpha = 1.0;
+    config.max_num_pilot_trials = 16;
+    const uint64_t max_num_threads = std::min<uint64_t>(4, std::thread::hardware_concurrency());
+    /* a pool smaller than num_threads: the missing threads are created on demand */
+    thread_pool pool(1);
+    config.pool = &pool;
+    for (uint64_t num_threads = 1; num_threads <= max_num_threads; num_threads *= 2) {
+        config.num_threads = num_threads;
+        builder_64.build_from_keys(keys, num_keys, config);
+        test_encoder<compact>(builder_64, config, keys, num_keys);              // C
+        test_encoder<partitioned_compact>(builder_64, config, keys, num_keys);  // PC
+        test_encoder<rice>(builder_64, config, keys, num_keys);                 // R
+        test_encoder<rice_rice>(builder_64, config, keys, num_keys);            // R-R
+        test_encoder<elias_fano>(builder_64, config, keys, num_keys);           // EF
+
+        /* the parallel encoding is the same as the sequential one */
+        auto const& pilots = builder_64.pilots();
+        partitioned_compact sequential, parallel;
+        sequential.encode(pilots.data(), pilots.size());
+        parallel.encode(pilots.data(), pilots.size(), num_threads + 1, &pool);
+        testing::require_equal(parallel.size(), sequential.size());
+        testing::require_equal(parallel.num_bits(), sequential.num_bits());
+        for (uint64_t i = 0; i != pilots.size(); ++i) {
+            testing::require_equal(parallel.access(i), sequential.access(i));
+        }
+    }
+    config.pool = nullptr;
+
+    /* keys read line by line, hashed in a pipeline when there are several threads */
+    std::vector<std::string> strings;
+    std::stringstream lines;
+    for (uint64_t i = 0; i != num_keys; ++i) {
+        strings.push_back(std::to_string(keys[i]));
+        lines << strings.back() << '\n';
+    }
+    internal_memory_builder_single_phf<xxhash_64, bucketer_type> strings_builder;
+    for (uint64_t num_threads = 1; num_threads <= max_num_threads; num_threads *= 2) {
+        config.num_threads = num_threads;
+        lines.clear();
+        lines.seekg(0);
+        strings_builder.build_from_keys(sequential_lines_iterator(lines), num_keys, config);
+        test_encoder<compact>(strings_builder, config, strings.begin(), num_keys);  // C
+    }
+
+    /* external-memory construction, with little RAM so that pairs are sorted in several runs */
+    external_memory_builder_single_phf<xxhash_64, bucketer_type> external_builder;
+    config.num_threads = 1;
+    config.ram = 1'000'000;
+    for (bool compress_tmp_files : {false, true}) {
+        config.compress_tmp_files = compress_tmp_files;
+        external_builder.build_from_keys(keys, num_keys, config);
+        test_encoder<compact>(external_builder, config, keys, num_keys);  // C
+        test_encoder<rice>(external_builder, config, keys, num_keys);     // R
+    }
+
+    /* the sorted runs are merged in parallel */
+    if (max_num_threads > 1) {
+        config.num_threads = 2;
+        external_builder.build_from_keys(keys, num_keys, config);
+        test_encoder<compact>(external_builder, config, keys, num_keys);  // C
+        config.num_threads = 1;
+    }
+
+    /* so little RAM that the bitmap of taken slots is paged from a temporary file */
+    config.ram = search_cache_size * sizeof(uint64_t) + 8 * ((num_keys + 63) / 64);
+    external_builder.build_from_keys(keys, num_keys, config);
+    test_encoder<compact>(external_builder, config, keys, num_keys);  // C
+}
+
+template <typename Hasher>
+void test_duplicate_keys(std::vector<uint64_t> const& keys) {
+    std::cout << "testing with duplicate keys..." << std::endl;
+
+    std::vector<uint64_t> dirty_keys = keys;
+    const uint64_t num_duplicates = keys.size() / 100 + 1;
+    for (uint64_t i = 0; i != num_duplicates; ++i) {
+        dirty_keys.push_back(keys[random_value() % keys.size()]);
+    }
+
+    build_configuration config;
+    config.minimal = true;
+    config.verbose = false;
+    config.seed = random_value();
+    uint64_t num_reported_duplicates = 0;
+    config.duplicate_keys_callback = [&](uint64_t i, uint64_t j) {
+        testing::require_equal(dirty_keys[i], dirty_keys[j]);
+        ++num_reported_duplicates;
+    };
+
+    internal_memory_builder_single_phf<Hasher, bucketer_type> builder;
+    bool failed = false;
+    try {
+        builder.build_from_keys(dirty_keys.begin(), dirty_keys.size(), config);
+    } catch (duplicate_keys_error const&) {
+        failed = true;
+    }
+    testing::require_equal(failed, true);
+    testing::require_equal(num_reported_duplicates, num_duplicates);
+
+    config.drop_duplicate_keys = true;
+    builder.build_from_keys(dirty_keys.begin(), dirty_keys.size(), config);
+    test_encoder<compact>(builder, config, keys.begin(), keys.size());
+}
+
+template <typename Hasher>
+void test_collected_keys(std::vector<uint64_t> const& keys) {
+    std::cout << "testing with keys of unknown number..." << std::endl;
+
+    build_configuration config;
+    config.minimal = true;
+    config.verbose = false;
+    config.num_threads = 1;
+
+    /* each of the threads adds a shard of the keys, none knows their total number */
+    hash_collector<Hasher> collector(config);
+    const uint64_t num_threads = 3;
+    std::vector<std::thread> threads;
+    for (uint64_t t = 0; t != num_threads; ++t) {
+        threads.emplace_back([&, t] {
+            auto producer = collector.get_producer();
+            for (uint64_t i = t; i < keys.size(); i += num_threads) producer.add(keys[i]);
+        });
+    }
+    for (auto& t : threads) t.join();
+
+    single_phf<Hasher, bucketer_type, dictionary_dictionary, true> f;
+    f.build_in_internal_memory(collector, config);
+    testing::require_equal(f.num_keys(), uint64_t(keys.size()));
+    testing::require_equal(f.seed(), collector.seed());
+    check(keys.begin(), f);
+
+    partitioned_phf<Hasher, bucketer_type, compact_compact, true> pf;
+    config.avg_partition_size = 5000;
+    pf.build_in_external_memory(collector, config);
+    testing::require_equal(pf.num_keys(), uint64_t(keys.size()));
+    check(keys.begin(), pf);
+}
+
+void test_binary_inputs(std::vector<uint64_t> const& keys) {
+    std::cout << "testing with binary inputs..." << std::endl;
+
+    build_configuration config;
+    config.minimal = true;
+    config.verbose = false;
+    config.seed = random_value();
+    internal_memory_builder_single_phf<xxhash_128, bucketer_type> builder;
+
+    /* integers are hashed as such, and views as the strings of the same bytes */
+    std::vector<uint8_t> uints(keys.size() * sizeof(uint64_t));
+    std::memcpy(uints.data(), keys.data(), uints.size());
+    builder.build_from_keys(binary_uints_iterator(uints.data(), sizeof(uint64_t)), keys.size(),
+                            config);
+    test_encoder<compact>(builder, config, keys.begin(), keys.size());
+
+    std::vector<std::string> strings;
+    std::vector<uint8_t> separated, prefixed;
+    for (auto key : keys) {
+        strings.push_back(std::to_string(key));
+        auto const& s = strings.back();
+        separated.insert(separated.end(), s.begin(), s.end());
+        separated.push_back('\0');
+        const uint32_t length = s.size();
+        auto length_bytes = reinterpret_cast<uint8_t const*>(&length);
+        prefixed.insert(prefixed.end(), length_bytes, length_bytes + sizeof(length));
+        prefixed.insert(prefixed.end(), s.begin(), s.end());
+    }
+    separated.pop_back();  // the last separator is optional
+
+    auto offsets = separated_strings_offsets(separated.data(),
+                                             separated.data() + separated.size(), '\0');
+    testing::require_equal(offsets.size() - 1, keys.size());
+    for (uint64_t num_threads = 2; num_threads <= 4; ++num_threads) {
+        auto parallel_offsets = separated_strings_offsets(
+            separated.data(), separated.data() + separated.size(), '\0', num_threads);
+        testing::require_equal(parallel_offsets == offsets, true);
+    }
+    builder.build_from_keys(string_views_iterator(separated.data(), offsets.data(), 1),
+                            keys.size(), config);
+    test_encoder<compact>(builder, config, strings.begin(), keys.size());
+
+    offsets = length_prefixed_strings_offsets(prefixed.data(), prefixed.data() + prefixed.size());
+    testing::require_equal(offsets.size() - 1, keys.size());
+    builder.build_from_keys(string_views_iterator(prefixed.data(), offsets.data(), 4),
+                            keys.size(), config);
+    test_encoder<compact>(builder, config, strings.begin(), keys.size());
 }
 
 int main() {
@@ -62,6 +250,10 @@ int main() {
         std::vector<uint64_t> keys = distinct_uints<uint64_t>(num_keys, random_value());
         assert(keys.size() == num_keys);
         test_internal_memory_single_mphf(keys.begin(), keys.size());
+        test_duplicate_keys<xxhash_64>(keys);
+        test_duplicate_keys<xxhash_128>(keys);
+        test_collected_keys<xxhash_128>(keys);
+        test_binary_inputs(keys);
     }
     return 0;
 }